@@ -0,0 +1,278 @@
+// Copyright 2022 Lawrence Livermore National Security, LLC and other
+// libjustify Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: MIT
+
+// Microbenchmarks for `make bench`.  Each shape (rows x columns of a
+// given mix of conversions, with narrow or wide values) is run in its
+// own child process so that peak RSS belongs to that shape alone, and
+// reports one line of JSON:  nanoseconds per cell spent appending and
+// flushing, library allocations per cell, peak RSS, and output bytes
+// per second, alongside plain fprintf() writing the same rows.
+//
+// Shapes marked bulk append each flush's rows with one call to
+// ctprintf_columns() from arrays filled beforehand.
+//
+// ./bench [substring] runs only the shapes whose names contain it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "cprintf.h"
+
+// Built with -Wl,--wrap=malloc (and calloc and realloc), so every
+// allocation the library makes comes through here.
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t n, size_t size );
+void *__real_realloc( void *p, size_t size );
+
+static size_t allocations;
+
+void *
+__wrap_malloc( size_t size ){
+    allocations++;
+    return __real_malloc( size );
+}
+
+void *
+__wrap_calloc( size_t n, size_t size ){
+    allocations++;
+    return __real_calloc( n, size );
+}
+
+void *
+__wrap_realloc( void *p, size_t size ){
+    allocations++;
+    return __real_realloc( p, size );
+}
+
+// The value in column c of row r.  m is 100 for narrow shapes and
+// large for wide ones.
+static const char *narrow_strings[] = { "a", "bc", "def", "g", "hi" };
+static const char *wide_strings[] = {
+    "a considerably longer string",
+    "short",
+    "something in between",
+    "the widest of all the strings used here",
+    "medium length"
+};
+
+#define INT(c)  ( (long)( ( (unsigned long)r * 2654435761UL + (c) ) % m ) )
+#define DBL(c)  ( (double)( ( (unsigned long)r * 40503UL + (c) ) % m ) / 7.0 )
+#define STR(c)  ( ( m <= 100 ? narrow_strings : wide_strings )[ ( r + (c) ) % 5 ] )
+
+#define ARGS4( X, o )   X( (o) ), X( (o)+1 ), X( (o)+2 ), X( (o)+3 )
+#define ARGS16( X )     ARGS4( X, 0 ), ARGS4( X, 4 ), ARGS4( X, 8 ), ARGS4( X, 12 )
+#define MIX4( o )       INT( (o) ), DBL( (o)+1 ), STR( (o)+2 ), INT( (o)+3 )
+#define MIX16           MIX4( 0 ), MIX4( 4 ), MIX4( 8 ), MIX4( 12 )
+
+// One row, to a table if t is set and with fprintf() otherwise, in
+// which case it returns the bytes written.
+typedef int (*row_fn)( ctable_t *t, FILE *f, const char *fmt, long r, long m );
+
+#define ROW_FN( name, ... )                                                 \
+static int                                                                  \
+name( ctable_t *t, FILE *f, const char *fmt, long r, long m ){              \
+    (void)m;                                                                \
+    if( t ){                                                                \
+        ctprintf( t, fmt, __VA_ARGS__ );                                    \
+        return 0;                                                           \
+    }                                                                       \
+    return fprintf( f, fmt, __VA_ARGS__ );                                  \
+}
+
+ROW_FN( int_4, ARGS4( INT, 0 ) )
+ROW_FN( int_16, ARGS16( INT ) )
+ROW_FN( double_4, ARGS4( DBL, 0 ) )
+ROW_FN( double_16, ARGS16( DBL ) )
+ROW_FN( string_4, ARGS4( STR, 0 ) )
+ROW_FN( string_16, ARGS16( STR ) )
+ROW_FN( mixed_4, MIX4( 0 ) )
+ROW_FN( mixed_16, MIX16 )
+
+struct shape{
+    const char *name;
+    const char *conversions;    // one per column, repeated as needed
+    size_t columns;
+    size_t rows;                // per flush
+    long m;
+    row_fn row;
+    bool bulk;
+};
+
+static const struct shape shapes[] = {
+    { "int-4x1000-narrow",          "d",    4,  1000,       100,        int_4,      false },
+    { "int-4x100000-narrow",        "d",    4,  100000,     100,        int_4,      false },
+    { "int-4x100000-wide",          "d",    4,  100000,     1000000007, int_4,      false },
+    { "int-16x100000-wide",         "d",    16, 100000,     1000000007, int_16,     false },
+    { "int-4x1000000-wide",         "d",    4,  1000000,    1000000007, int_4,      false },
+    { "double-4x100000-narrow",     "f",    4,  100000,     100,        double_4,   false },
+    { "double-4x100000-wide",       "f",    4,  100000,     1000000007, double_4,   false },
+    { "double-16x100000-wide",      "f",    16, 100000,     1000000007, double_16,  false },
+    { "string-4x100000-narrow",     "s",    4,  100000,     100,        string_4,   false },
+    { "string-16x100000-wide",      "s",    16, 100000,     1000000007, string_16,  false },
+    { "mixed-4x1000-wide",          "dfsd", 4,  1000,       1000000007, mixed_4,    false },
+    { "mixed-4x100000-wide",        "dfsd", 4,  100000,     1000000007, mixed_4,    false },
+    { "mixed-16x100000-wide",       "dfsd", 16, 100000,     1000000007, mixed_16,   false },
+    { "mixed-4x1000000-narrow",     "dfsd", 4,  1000000,    100,        mixed_4,    false },
+    { "bulk-int-4x100000-wide",     "d",    4,  100000,     1000000007, int_4,      true },
+    { "bulk-double-4x100000-wide",  "f",    4,  100000,     1000000007, double_4,   true },
+    { "bulk-mixed-4x100000-wide",   "dfsd", 4,  100000,     1000000007, mixed_4,    true },
+};
+
+#define MINIMUM_CELLS ((size_t)4 * 1000 * 1000)    // per shape, over all flushes
+
+static FILE *devnull;
+static size_t bytes;
+
+static void
+count_and_discard( void *context, const char *data, size_t length ){
+    (void)context;
+    bytes += length;
+    fwrite( data, 1, length, devnull );
+}
+
+static double
+now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+build_format( char *fmt, const struct shape *s ){
+    // "%ld %.3f %s %ld\n" and so on.
+    size_t c, n = strlen( s->conversions );
+    char *p = fmt;
+    for( c = 0; c < s->columns; c++ ){
+        switch( s->conversions[ c % n ] ){
+            case 'd':   p += sprintf( p, "%%ld" );     break;
+            case 'f':   p += sprintf( p, "%%.3f" );    break;
+            case 's':   p += sprintf( p, "%%s" );      break;
+        }
+        *p++ = c + 1 < s->columns ? ' ' : '\n';
+    }
+    *p = '\0';
+}
+
+static cprintf_column_t *
+fill_columns( const struct shape *s ){
+    // The values row_fn would pass, one array per column.
+    cprintf_column_t *columns = calloc( s->columns, sizeof( cprintf_column_t ) );
+    size_t c, n = strlen( s->conversions );
+    long r, m = s->m;
+    for( c = 0; c < s->columns; c++ ){
+        switch( s->conversions[ c % n ] ){
+            case 'd':{
+                long *a = malloc( s->rows * sizeof( long ) );
+                for( r = 0; r < (long)s->rows; r++ ){ a[r] = INT( c ); }
+                columns[c] = CPRINTF_ARRAY( a );
+                break;
+            }
+            case 'f':{
+                double *a = malloc( s->rows * sizeof( double ) );
+                for( r = 0; r < (long)s->rows; r++ ){ a[r] = DBL( c ); }
+                columns[c] = CPRINTF_ARRAY( a );
+                break;
+            }
+            case 's':{
+                const char **a = malloc( s->rows * sizeof( const char * ) );
+                for( r = 0; r < (long)s->rows; r++ ){ a[r] = STR( c ); }
+                columns[c] = CPRINTF_ARRAY( a );
+                break;
+            }
+        }
+    }
+    return columns;
+}
+
+static void
+run( const struct shape *s ){
+    static char fmt[256];
+    size_t flushes = ( MINIMUM_CELLS + s->rows * s->columns - 1 ) / ( s->rows * s->columns );
+    size_t i, cells = flushes * s->rows * s->columns, fprintf_bytes = 0;
+    double t0, append = 0, flush = 0, baseline;
+    struct rusage usage;
+    cprintf_column_t *columns = NULL;
+    ctable_t *t;
+    long r;
+    FILE *f;
+
+    build_format( fmt, s );
+    devnull = fopen( "/dev/null", "w" );
+    if( s->bulk ){
+        columns = fill_columns( s );
+    }
+
+    allocations = 0;
+    t = ctcreate_callback( count_and_discard, NULL );
+    for( i = 0; i < flushes; i++ ){
+        t0 = now();
+        if( s->bulk ){
+            ctprintf_columns( t, fmt, s->rows, columns, s->columns );
+        }else{
+            for( r = 0; r < (long)s->rows; r++ ){
+                s->row( t, NULL, fmt, r, s->m );
+            }
+        }
+        append += now() - t0;
+        t0 = now();
+        ctflush( t );
+        flush += now() - t0;
+    }
+    ctdestroy( t );
+    getrusage( RUSAGE_SELF, &usage );
+
+    // The same rows, unaligned, with fprintf().
+    f = fopen( "/dev/null", "w" );
+    t0 = now();
+    for( i = 0; i < flushes; i++ ){
+        for( r = 0; r < (long)s->rows; r++ ){
+            fprintf_bytes += s->row( NULL, f, fmt, r, s->m );
+        }
+        fflush( f );
+    }
+    baseline = now() - t0;
+    fclose( f );
+    fclose( devnull );
+
+    printf( "{\"shape\":\"%s\",\"rows\":%zu,\"columns\":%zu,\"flushes\":%zu,\"cells\":%zu,"
+            "\"append_ns_per_cell\":%.2f,\"flush_ns_per_cell\":%.2f,\"allocs_per_cell\":%.6f,"
+            "\"peak_rss_kb\":%ld,\"bytes\":%zu,\"bytes_per_sec\":%.0f,"
+            "\"fprintf_ns_per_cell\":%.2f,\"fprintf_bytes\":%zu,\"fprintf_bytes_per_sec\":%.0f}\n",
+            s->name, s->rows, s->columns, flushes, cells,
+            append / cells, flush / cells, (double)allocations / cells,
+            usage.ru_maxrss, bytes, bytes / ( ( append + flush ) / 1e9 ),
+            baseline / cells, fprintf_bytes, fprintf_bytes / ( baseline / 1e9 ) );
+    fflush( stdout );
+}
+
+int
+main( int argc, char **argv ){
+    size_t i;
+    pid_t pid;
+    int status, failures = 0;
+
+    for( i = 0; i < sizeof( shapes ) / sizeof( shapes[0] ); i++ ){
+        if( argc > 1 && NULL == strstr( shapes[i].name, argv[1] ) ){
+            continue;
+        }
+        pid = fork();
+        if( 0 == pid ){
+            run( &shapes[i] );
+            _exit( 0 );
+        }
+        waitpid( pid, &status, 0 );
+        if( !WIFEXITED( status ) || 0 != WEXITSTATUS( status ) ){
+            fprintf( stderr, "bench: %s failed\n", shapes[i].name );
+            failures++;
+        }
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -5,15 +5,368 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
 #ifndef __CPRINTF_H_HEADER
 #define __CPRINTF_H_HEADER
 void cprintf( const char* fmt, ... );
 void cfprintf( FILE *stream, const char* fmt, ... );
+void csnprintf( char *str, size_t size, const char* fmt, ... );
 
 void cvprintf( const char* fmt, va_list args );
 void cvfprintf( FILE *stream, const char* fmt, va_list args );
+void cvsnprintf( char *str, size_t size, const char* fmt, va_list args );
 
 void cflush( void );
+
+// Independent tables.  cprintf() and friends above write to a default
+// table private to the calling thread; a ctable_t is a table of its own
+// bound to one stream, so several can be filled side by side.
+// ctdestroy() flushes anything still captured before freeing the table.
+typedef struct ctable ctable_t;
+
+ctable_t *ctcreate( FILE *stream );
+
+// Other destinations.  Output is assembled into large buffers before
+// it is handed over, so a flush costs a few writes rather than one per
+// cell.  A file descriptor gets writev().  A buffer of size bytes is
+// filled like snprintf(), always '\0'-terminated, with ctlength()
+// reporting how many bytes the table needed in all.  A string grows as
+// needed; ctstring() hands it to the caller to free() and starts a new
+// one.  A callback is given each buffer as it fills.  csnprintf() is
+// the buffer version of cprintf(); its rows go to str at cflush().  If
+// a write to a stream or file descriptor fails, the table drops its
+// output from then on; cterror() returns the errno of that write, or 0
+// if none failed, and lets the table write again.  cerror() does the
+// same for the default table.
+typedef void (*cprintf_write_fn)( void *context, const char *data, size_t length );
+
+ctable_t *ctcreate_fd( int fd );
+ctable_t *ctcreate_buffer( char *buffer, size_t size );
+ctable_t *ctcreate_string( void );
+ctable_t *ctcreate_callback( cprintf_write_fn write, void *context );
+size_t ctlength( ctable_t *table );
+char *ctstring( ctable_t *table );
+int cterror( ctable_t *table );
+int cerror( void );
+void ctprintf( ctable_t *table, const char* fmt, ... );
+void ctvprintf( ctable_t *table, const char* fmt, va_list args );
+void ctflush( ctable_t *table );
+void ctdestroy( ctable_t *table );
+
+// Shared tables.  Any number of threads may call ctprintf() or
+// ctkprintf() on a shared table at the same time; each call still
+// produces one row.  ctflush() prints the rows in the order they were
+// appended or, with CPRINTF_ORDER_KEY, sorted by the key passed to
+// ctkprintf() (rows from ctprintf() have a key of 0), with ties kept
+// in append order.  Only one thread may flush a shared table at a
+// time.  A flush prints the rows appended before it began, with the
+// columns sized to exactly those rows; rows appended while it is
+// underway wait for the next flush.
+typedef enum{
+    CPRINTF_ORDER_INSERTION,
+    CPRINTF_ORDER_KEY
+}cprintf_order_t;
+
+ctable_t *ctcreate_shared( FILE *stream, cprintf_order_t order );
+void ctkprintf( ctable_t *table, int64_t key, const char* fmt, ... );
+
+// Streaming mode.  Instead of holding every row until cflush(), the
+// first warmup_rows rows fix the column widths and are printed, and
+// each later row is printed as soon as it is complete, so memory use
+// does not grow with the number of rows.  min_widths (which may be
+// NULL) gives a floor for the width of each conversion, in the order
+// the conversions appear in a row; with warmup_rows of 0 they alone
+// set the initial widths.  overflow says what happens when a later
+// value doesn't fit.  The settings stay in effect across cflush()
+// until cbuffer() restores the default of buffering the whole table.
+typedef enum{
+    CPRINTF_WIDEN,      // widen the column for this and later rows
+    CPRINTF_TRUNCATE,   // cut the value to the column width
+    CPRINTF_REHEADER    // widen, then reprint the table's first row
+}cprintf_overflow_t;
+
+void cstream( size_t warmup_rows, const size_t *min_widths, size_t nwidths, cprintf_overflow_t overflow );
+void cbuffer( void );
+void ctstream( ctable_t *table, size_t warmup_rows, const size_t *min_widths, size_t nwidths, cprintf_overflow_t overflow );
+void ctbuffer( ctable_t *table );
+
+// Spilling.  Once the rows buffered for the current table take more
+// than threshold bytes, they are moved to an unlinked temporary file
+// in directory (or $TMPDIR, or /tmp, if directory is NULL).  cflush()
+// reads them back in order, so the output is the same as if every row
+// had stayed in memory.  A threshold of 0 turns spilling off.
+void cspill( size_t threshold, const char *directory );
+void ctspill( ctable_t *table, size_t threshold, const char *directory );
+
+// Asynchronous flushes.  ctflush_async() hands the rows captured so far
+// to a background writer thread and returns at once, leaving the table
+// empty and ready for more rows.  Tables are written in the order they
+// were handed over, and a later ctflush() on the same table waits for
+// its earlier rows to be written first.  ctflush_wait() waits until
+// every row handed over from the table has been written; at exit, the
+// writer finishes whatever it has been given.  Streaming, shared and
+// spilling tables, and tables writing to a buffer or string, are
+// flushed on the calling thread as by ctflush().  Statistics include a
+// flush once it has been written, and hooks run on the writer thread.
+void cflush_async( void );
+void cflush_wait( void );
+void ctflush_async( ctable_t *table );
+void ctflush_wait( ctable_t *table );
+
+// Parallel flushes.  With nthreads above 1, flushing a large table
+// cuts its rows into chunks that are padded into separate buffers on up
+// to nthreads threads (the flushing thread among them) and written out
+// in order, so the output is the same as from one thread.  An nthreads
+// of 0 means one thread per online processor.
+void cthreads( size_t nthreads );
+void ctthreads( ctable_t *table, size_t nthreads );
+
+// Sticky widths, for reports printed with the same formats over and
+// over.  A sticky table keeps its column widths from one flush to the
+// next, so they only grow, and each format learns the widest value of
+// each of its conversions, which becomes a floor for that column
+// whenever the format is used again, much as min_widths are for
+// cstream().  ctsave_widths() writes what has been learned to a small
+// text file, by format, and ctload_widths() reads one back and makes
+// the table sticky, so a later run can stream from its first row with
+// the widths of earlier runs.  Both return 0, or -1 if the file can't
+// be read or written.  Shared tables keep their widths but don't learn.
+void csticky( int on );
+void ctsticky( ctable_t *table, int on );
+int cload_widths( const char *path );
+int ctload_widths( ctable_t *table, const char *path );
+int csave_widths( const char *path );
+int ctsave_widths( ctable_t *table, const char *path );
+
+// Live tables, for dashboards that are flushed over and over.  With
+// live mode on, each flush is compared with the frame before it, and
+// only the cells that changed are written, over the old ones, using
+// ANSI cursor movements; if a column's width changed, every line is
+// written again.  Output must go to a terminal wide enough that no
+// line wraps, and nothing else may be written to it between flushes.
+// Live tables don't spill, and ctflush_async() flushes them at once.
+void clive( int on );
+void ctlive( ctable_t *table, int on );
+
+// Exports.  ctflush_as() flushes a table as ctflush() does, but writes
+// the captured values for other programs to read instead of padding
+// them into columns:  CSV (quoted as RFC 4180 asks), TSV (with \t, \n,
+// \r and \\ escaped), JSON Lines (an array per row), or a binary
+// columnar file described in cprintf.c.  Only conversions are written.
+// Integers and floating point values come from the values themselves,
+// not their text, and strings lose the padding of their field width.
+// In streaming mode only rows still held for warm-up are exported.
+typedef enum{
+    CPRINTF_TEXT,       // padded columns, as ctflush()
+    CPRINTF_CSV,
+    CPRINTF_TSV,
+    CPRINTF_JSONL,
+    CPRINTF_BINARY
+}cprintf_export_t;
+
+void cflush_as( cprintf_export_t form );
+void ctflush_as( ctable_t *table, cprintf_export_t form );
+
+// Sorting.  With keys set, each flush prints rows in order of their
+// keys, each of which names a conversion, counting from 0 within the
+// row, and is compared by the value that was passed rather than its
+// text:  numbers as numbers, with NaN last, and strings byte by byte
+// without their field width's padding.  Earlier keys decide first, and
+// rows that tie stay in the order they were appended.  Rows missing a
+// key, or whose keys aren't the same kinds (number or string) as those
+// of the last row that has them all, such as a header, are printed
+// first, as they came.  With top set, only the first top sorted rows
+// are printed, and they are picked as rows are appended, so the table
+// holds not many more than top of them however many arrive.  Sorted
+// tables don't spill, and streaming tables ignore their keys.  An
+// nkeys of 0 turns sorting off.
+typedef struct{
+    size_t conversion;
+    int descending;
+}cprintf_sort_key_t;
+
+void csort( const cprintf_sort_key_t *keys, size_t nkeys, size_t top );
+void ctsort( ctable_t *table, const cprintf_sort_key_t *keys, size_t nkeys, size_t top );
+
+// Aggregate footers.  With any of these set, each flush ends the table
+// with a row per aggregate, in the order below, summarizing every
+// integer and floating point conversion appended since the last flush
+// by column.  The values are added up as rows are appended, so the
+// footers take no extra pass over the rows.  Footer rows have the shape
+// of the last row appended with a number in it:  its ordinary text, and
+// each number printed with that row's conversion for its column, made
+// wide enough to hold it (%d becomes %jd, %.2f becomes %.2Lf).  The
+// first %s (or %ls) conversion is given the aggregate's name ("sum",
+// "min", "max" or "mean"); %c and %p never are, and a row with no %s
+// gets no label.  Other columns are left blank.  Means of integer
+// columns are rounded to the nearest integer.  The aggregates include
+// rows a top-N sort leaves out.  Exports get no footers.
+typedef enum{
+    CPRINTF_SUM     = 1,
+    CPRINTF_MIN     = 2,
+    CPRINTF_MAX     = 4,
+    CPRINTF_MEAN    = 8
+}cprintf_aggregate_t;
+
+void cfooter( int aggregates );
+void ctfooter( ctable_t *table, int aggregates );
+
+// Statistics.  ctstats() reports on a table since it was created:  the
+// rows and cells (conversions) captured, flushes, the bytes of memory
+// the table holds now, how many allocations have been made for it, and
+// the bytes written out.  With timing on it also reports nanoseconds
+// spent looking up formats, measuring values as rows are captured, and
+// in each phase of a flush.  Setting CPRINTF_STATS in the environment
+// turns timing on for every table and has each flush write a line of
+// these to stderr.  Rows appended to a shared table are counted when
+// they are flushed, and the time taken to capture them isn't measured.
+typedef enum{
+    CPRINTF_PHASE_FLUSH,    // all of ctflush()
+    CPRINTF_PHASE_GATHER,   // collecting the rows of a shared table
+    CPRINTF_PHASE_FORMAT,   // padding cells into the output buffers
+    CPRINTF_PHASE_WRITE,    // handing buffers to the destination, which
+                            // also happens within FORMAT as they fill
+    CPRINTF_PHASES
+}cprintf_phase_t;
+
+typedef struct{
+    uint64_t rows;
+    uint64_t cells;
+    uint64_t flushes;
+    size_t bytes_held;
+    uint64_t allocations;
+    uint64_t bytes_written;
+    uint64_t parse_ns;
+    uint64_t measure_ns;
+    uint64_t phase_ns[ CPRINTF_PHASES ];
+}cprintf_stats_t;
+
+void cprintf_stats( cprintf_stats_t *stats );
+void ctstats( ctable_t *table, cprintf_stats_t *stats );
+void cprintf_timing( int on );
+void cttiming( ctable_t *table, int on );
+
+// Hooks.  A hook is called on the flushing thread as each phase begins
+// (with begin set to 1) and ends (0), for feeding a tracer.  Streaming
+// tables also format and write as each row is printed.  A NULL hook
+// removes it.
+typedef void (*cprintf_hook_fn)( void *context, cprintf_phase_t phase, int begin );
+
+void cprintf_hook( cprintf_hook_fn hook, void *context );
+void cthook( ctable_t *table, cprintf_hook_fn hook, void *context );
+
+// Typed rows.  CPRINTF_ROW( fmt, a, b, c ) appends a row like
+// cprintf( fmt, a, b, c ), but each argument is tagged with its C type
+// at compile time (by _Generic) and stored directly, with no va_arg().
+// Arguments are checked against the format as the row is captured:
+// the count must match, integers must go to integer conversions (and
+// are converted to the type the conversion expects, as a cast would),
+// floating point to floating point, and pointers to %s, %ls or %p.
+// CTPRINTF_ROW( table, fmt, ... ) does the same for a table.  Rows
+// take between 1 and 16 arguments.
+typedef enum{
+    CPRINTF_ARG_SIGNED,         // signed integers, including char
+    CPRINTF_ARG_UNSIGNED,       // unsigned integers and _Bool
+    CPRINTF_ARG_DOUBLE,         // double and float
+    CPRINTF_ARG_LONG_DOUBLE,
+    CPRINTF_ARG_STRING,         // char *
+    CPRINTF_ARG_WIDE_STRING,    // wchar_t *
+    CPRINTF_ARG_POINTER         // any other pointer
+}cprintf_arg_type_t;
+
+typedef struct{
+    cprintf_arg_type_t type;
+    union{
+        intmax_t i;
+        uintmax_t u;
+        double d;
+        const void *p;
+    }value;
+    long double ld;             // kept out of the union, whose ABI GCC warns about
+}cprintf_arg_t;
+
+void cprintf_args( const char *fmt, const cprintf_arg_t *args, size_t nargs );
+void ctprintf_args( ctable_t *table, const char *fmt, const cprintf_arg_t *args, size_t nargs );
+
+static inline cprintf_arg_t cprintf_arg_signed( intmax_t v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_SIGNED, .value.i = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_unsigned( uintmax_t v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_UNSIGNED, .value.u = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_double( double v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_DOUBLE, .value.d = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_long_double( long double v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_LONG_DOUBLE, .ld = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_string( const char *v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_STRING, .value.p = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_wide_string( const wchar_t *v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_WIDE_STRING, .value.p = v }; return a; }
+static inline cprintf_arg_t cprintf_arg_pointer( const void *v ){ cprintf_arg_t a = { .type = CPRINTF_ARG_POINTER, .value.p = v }; return a; }
+
+#define CPRINTF_ARG( x ) _Generic( (x),                                 \
+    char: cprintf_arg_signed,                                           \
+    signed char: cprintf_arg_signed,                                    \
+    short: cprintf_arg_signed,                                          \
+    int: cprintf_arg_signed,                                            \
+    long: cprintf_arg_signed,                                           \
+    long long: cprintf_arg_signed,                                      \
+    _Bool: cprintf_arg_unsigned,                                        \
+    unsigned char: cprintf_arg_unsigned,                                \
+    unsigned short: cprintf_arg_unsigned,                               \
+    unsigned int: cprintf_arg_unsigned,                                 \
+    unsigned long: cprintf_arg_unsigned,                                \
+    unsigned long long: cprintf_arg_unsigned,                           \
+    float: cprintf_arg_double,                                          \
+    double: cprintf_arg_double,                                         \
+    long double: cprintf_arg_long_double,                               \
+    char *: cprintf_arg_string,                                         \
+    const char *: cprintf_arg_string,                                   \
+    wchar_t *: cprintf_arg_wide_string,                                 \
+    const wchar_t *: cprintf_arg_wide_string,                           \
+    default: cprintf_arg_pointer )( x )
+
+#define CPRINTF_NARGS_( _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ... ) N
+#define CPRINTF_NARGS( ... ) CPRINTF_NARGS_( __VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 )
+#define CPRINTF_CAT_( a, b ) a ## b
+#define CPRINTF_CAT( a, b ) CPRINTF_CAT_( a, b )
+#define CPRINTF_MAP_1( x ) CPRINTF_ARG( x )
+#define CPRINTF_MAP_2( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_1( __VA_ARGS__ )
+#define CPRINTF_MAP_3( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_2( __VA_ARGS__ )
+#define CPRINTF_MAP_4( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_3( __VA_ARGS__ )
+#define CPRINTF_MAP_5( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_4( __VA_ARGS__ )
+#define CPRINTF_MAP_6( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_5( __VA_ARGS__ )
+#define CPRINTF_MAP_7( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_6( __VA_ARGS__ )
+#define CPRINTF_MAP_8( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_7( __VA_ARGS__ )
+#define CPRINTF_MAP_9( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_8( __VA_ARGS__ )
+#define CPRINTF_MAP_10( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_9( __VA_ARGS__ )
+#define CPRINTF_MAP_11( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_10( __VA_ARGS__ )
+#define CPRINTF_MAP_12( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_11( __VA_ARGS__ )
+#define CPRINTF_MAP_13( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_12( __VA_ARGS__ )
+#define CPRINTF_MAP_14( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_13( __VA_ARGS__ )
+#define CPRINTF_MAP_15( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_14( __VA_ARGS__ )
+#define CPRINTF_MAP_16( x, ... ) CPRINTF_ARG( x ), CPRINTF_MAP_15( __VA_ARGS__ )
+#define CPRINTF_MAP( ... ) CPRINTF_CAT( CPRINTF_MAP_, CPRINTF_NARGS( __VA_ARGS__ ) )( __VA_ARGS__ )
+
+#define CPRINTF_ROW( fmt, ... ) \
+    cprintf_args( (fmt), (const cprintf_arg_t[]){ CPRINTF_MAP( __VA_ARGS__ ) }, CPRINTF_NARGS( __VA_ARGS__ ) )
+#define CTPRINTF_ROW( table, fmt, ... ) \
+    ctprintf_args( (table), (fmt), (const cprintf_arg_t[]){ CPRINTF_MAP( __VA_ARGS__ ) }, CPRINTF_NARGS( __VA_ARGS__ ) )
+
+// Bulk rows.  ctprintf_columns() appends nrows rows at once from data
+// already held in arrays, one array per conversion in fmt.  The value
+// for row r of columns[k] is at base + r * stride bytes, so stride is
+// the size of an element for a plain array (CPRINTF_ARRAY()) or of the
+// struct for a member of an array of structs (CPRINTF_MEMBER()).
+// Elements have the type the conversion takes before promotion:  int
+// for %d, short for %hd, char for %c, double for %f, char * for %s.
+// The format is looked up once, and each column is loaded and measured
+// in a loop of its own rather than through a call per row.
+typedef struct{
+    const void *base;
+    size_t stride;
+}cprintf_column_t;
+
+#define CPRINTF_ARRAY( array ) \
+    ( (cprintf_column_t){ (array), sizeof( (array)[0] ) } )
+#define CPRINTF_MEMBER( array, member ) \
+    ( (cprintf_column_t){ &( (array)[0].member ), sizeof( (array)[0] ) } )
+
+void cprintf_columns( const char *fmt, size_t nrows, const cprintf_column_t *columns, size_t ncolumns );
+void ctprintf_columns( ctable_t *table, const char *fmt, size_t nrows, const cprintf_column_t *columns, size_t ncolumns );
 #endif
 
 
@@ -7,13 +7,27 @@
 #include <stddef.h>     // NULL
 #include <assert.h>     // assert
 #include <string.h>     // strncmp
-#include <stdlib.h>     // calloc
+#include <stdlib.h>     // malloc, calloc
 #include <stdio.h>      // fprintf
 #include <string.h>     // strspan
 #include <stdarg.h>     // variadic
 #include <wchar.h>      // wint_t
 #include <uchar.h>
 #include <stdint.h>     // intmax_t
+#include <unistd.h>     // write, close, unlink
+#include <sys/mman.h>   // mmap
+#include <sys/uio.h>    // writev
+#include <errno.h>      // EINTR
+#include <pthread.h>    // pthread_key_create
+#include <stdatomic.h>  // shared tables
+#include <float.h>      // LDBL_MANT_DIG
+#include <math.h>       // isnan
+#include <limits.h>     // INT_MIN
+#include <time.h>       // clock_gettime
+#include <inttypes.h>   // PRIu64
+#if defined( __SSE2__ )
+#include <emmintrin.h>  // _mm_movemask_epi8
+#endif
 #include "cprintf.h"
 
 // These are the types that printf and friends are aware of.
@@ -59,17 +73,25 @@ typedef enum{
     C_VOIDX
 }type_t;
 
-struct atom{
-    // Atoms should be allocated with calloc().  However, the value of
-    // NULL is implementation-dependent, so be sure any new pointers
-    // added here are explicitly set to NULL in create_atom() and freed
-    // in free_graph();
+// How a rendered value is widened to its column's width.  This is
+// worked out once per piece, when the format is compiled.
+typedef enum{
+    PAD_LEFT,       // spaces before the text (the default)
+    PAD_RIGHT,      // spaces after the text ('-' flag)
+    PAD_ZERO        // zeros after any sign or 0x prefix ('0' flag)
+}padding_t;
+
+// A format string is compiled once into an array of pieces.  Each
+// piece is either a run of ordinary text or a single conversion
+// specification, already split into its parts and with the argument
+// type decoded.  Pieces live in the format cache and are shared by
+// every cell captured from that format.
+struct piece{
     bool is_conversion_specification;
-    size_t original_field_width;
-    size_t new_field_width;
 
     char *original_specification;
-    char *new_specification;
+    char *unpadded_specification;   // without the field width, for %c, %s
+                                    // and %p given one; NULL otherwise
 
     char *flags;
     char *field_width;
@@ -78,217 +100,637 @@ struct atom{
     char *conversion_specifier;
 
     char *ordinary_text;
+    size_t ordinary_length;
 
-    va_list *pargs;
     type_t type;
-    value  val;
+    padding_t padding;
+
+    // Integer and floating point conversions are handled by the kernels
+    // below rather than by snprintf().  base is 0 for everything but
+    // integers, and style for everything but floating point; both are 0
+    // for specifications with flags the kernels don't handle.
+    unsigned int base;      // 8, 10 or 16
+    char style;             // 'f', 'e', 'g' or 'a'
+    bool is_signed;         // d, i
+    bool uppercase;         // X
+    bool alternate;         // '#'
+    char sign;              // '+', ' ' or '\0'
+    int narrow;             // sizeof the hh or h type, 0 otherwise
+    long precision_value;   // -1 if not given
+    uint32_t minimum_width; // field width
+};
+
+struct format{
+    struct format *next;    // hash chain
+    const char *key;        // caller's pointer
+    char *fmt;              // caller's contents, at the time of compilation
+    size_t npieces;
+    struct piece *pieces;
+    uint32_t *widths;       // widest value of each piece seen (ctsticky())
+    bool uncached;          // compiled for one row; see lookup_format()
+};
+
+// The table is stored by column.  Each column is one contiguous array
+// of compact cells; the conversion specification a cell was captured
+// with is shared through its piece rather than copied.  Column n holds
+// the nth piece of every row that has at least n+1 pieces, in row order.
+struct cell{
+    const struct piece *piece;
+    char *text;             // rendered value, or the piece's ordinary text;
+                            // NULL for integers printed from val at flush
+    uint32_t length;        // bytes in text
+    uint32_t width;         // terminal columns text takes (integers
+                            // appended in bulk keep neither)
+    uint32_t pad;           // bytes of text that are field width padding
+    value val;
+};
 
-    // navigation
-    struct atom *right;
-    struct atom *left;
-    struct atom *up;
-    struct atom *down;
+struct column{
+    struct cell *cells;
+    size_t ncells;
+    size_t capacity;
+    size_t width;           // widest conversion so far in this column
+    size_t next;            // emission cursor
 };
 
-void dump_graph( void );
-void _free_graph( struct atom *a );
-void free_graph();
-struct atom * create_atom( bool is_newline );
+// Every rendered value and compiled format lives in a chain of
+// large blocks.  Allocation bumps a cursor; cflush() rewinds the cursor
+// to the first block and keeps the blocks around, so once a table has
+// grown to its working size, later flush cycles never call malloc().
+struct arena_block{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+// Rendered strings (%s and %ls) are interned in the arena they are
+// copied into, so a column that repeats a handful of values, such as
+// host names or states, holds one copy of each rather than one per
+// row.  The slots are open addressed.  A slot is only good for the
+// epoch it was filled in:  arena_reset() starts a new epoch rather
+// than clearing them.  Past INTERN_LIMIT distinct strings in one
+// flush cycle, new strings are copied without being remembered.
+struct interned{
+    const char *text;
+    uint32_t length;
+    uint32_t hash;
+    uint64_t epoch;
+};
+
+struct arena{
+    struct arena_block *first;
+    struct arena_block *current;
+    size_t allocated;       // bytes handed out since the last reset
+    size_t held;            // bytes in all blocks and the intern slots
+    size_t blocks;          // blocks and intern slots ever malloc()ed
+    struct interned *strings;
+    size_t string_slots;    // a power of two
+    size_t nstrings;        // interned this epoch
+    uint64_t epoch;
+};
+
+#define ARENA_BLOCK_SIZE ((size_t)64 * 1024)
+#define INTERN_SLOTS 256
+#define INTERN_LIMIT 16384
+
+// Format strings are looked up by address first and then checked by
+// contents, so a buffer that is rewritten between calls still gets the
+// right pieces.  Programs that generate an unbounded number of distinct
+// formats stop filling the cache at FORMAT_CACHE_LIMIT entries; after
+// that new formats are compiled into a separate arena and dropped at
+// the next flush, or as soon as their row is printed when streaming.
+#define FORMAT_CACHE_BUCKETS 256
+#define FORMAT_CACHE_LIMIT 1024
+
+void *arena_alloc( struct arena *arena, size_t size );
+void arena_reset( struct arena *arena );
+void arena_free( struct arena *arena );
+void dump_table( struct ctable *t );
+void clear_rows( struct ctable *t );
+void reset_table( struct ctable *t );
+struct cell * append_cell( struct ctable *t, size_t column, const struct piece *piece );
 ptrdiff_t parse_flags( const char *p );
 ptrdiff_t parse_field_width( const char *p );
 ptrdiff_t parse_precision( const char *p );
 ptrdiff_t parse_length_modifier( const char *p );
 ptrdiff_t parse_conversion_specifier( const char *p );
-void archive( const char *p, ptrdiff_t span, char **q );
+void archive( struct arena *arena, const char *p, ptrdiff_t span, char **q );
 bool is( char *p, const char *q );
-void _cprintf( FILE *stream, const char *fmt, va_list *args );
+type_t decode_type( const struct piece *piece );
+padding_t decode_padding( const struct piece *piece );
+void decode_integer( struct piece *piece );
+void decode_float( struct piece *piece );
+struct format * compile_format( struct arena *arena, const char *fmt );
+const struct format * lookup_format( struct ctable *t, const char *fmt );
+// A row's arguments come either from a va_list (the printf-style
+// calls), from an array tagged at compile time (CPRINTF_ROW()), or
+// from one row of a set of column arrays (ctprintf_columns()).
+struct arguments{
+    va_list *list;
+    const cprintf_arg_t *array;
+    size_t count;
+    size_t next;
+    const cprintf_column_t *columns;
+    size_t row;
+};
 
-static struct atom *origin = NULL;
-static FILE *dest = NULL;
+struct sink;
+void _cprintf( struct ctable *t, const struct sink *sink, const char *fmt, struct arguments *args );
 
-void
-dump_graph( void ){
-    struct atom *a = origin, *c;
-    while( NULL != a ){
-        // Address of this atom.
-        c = a;
-        while( NULL != c ){
-            printf("p=%-20p", c );
-            c = c->right;
-        }
-        printf("\n");
+// Streaming mode (see ctstream()).  Rows are buffered as usual until
+// warmup_rows have arrived; those rows fix the column widths and are
+// printed, and from then on each row is printed and dropped as soon as
+// it is complete.  The first row of the table is kept as the header
+// for CPRINTF_REHEADER.
+struct streaming{
+    bool enabled;
+    bool started;
+    size_t warmup_rows;
+    size_t *min_widths;     // indexed by conversion, not by column
+    size_t nwidths;
+    cprintf_overflow_t overflow;
+    struct cell *header;
+    uint32_t header_length;
+    struct arena arena;     // header cells and text
+};
 
-        // Address of atom to the left.
-        c = a;
-        while( NULL != c ){
-            printf("l=%-20p", c->left );
-            c = c->right;
-        }
-        printf("\n");
+// Sticky widths (see ctsticky()).  Column widths survive flushes, and
+// each format remembers the widest value of each of its conversions,
+// which then serves as a floor for that conversion's column in the
+// same way as ctstream()'s min_widths.  A profile holds widths loaded
+// from a file, by format, to be handed to formats as they're compiled
+// and written back out with whatever has been learned since.
+struct profile_entry{
+    struct profile_entry *next;
+    char *fmt;
+    uint32_t *widths;       // of each conversion
+    size_t nwidths;
+};
 
-        // Address of atom to the right.
-        c = a;
-        while( NULL != c ){
-            printf("r=%-20p", c->right );
-            c = c->right;
-        }
-        printf("\n");
+struct profile{
+    struct profile_entry *entries;
+    struct arena arena;
+};
 
-        // Address of atom above.
-        c = a;
-        while( NULL != c ){
-            printf("u=%-20p", c->up );
-            c = c->right;
-        }
-        printf("\n");
+// Spilling (see ctspill()).  Once the rows held in memory pass
+// threshold bytes they are serialized to an unlinked temporary file
+// and dropped; the column widths stay in memory.  ctflush() maps the
+// file and prints the rows back in order.  Each row is a uint32_t
+// piece count followed by one spilled_cell per piece, each followed
+// by the rendered text of conversions.
+struct spilled_cell{
+    const struct piece *piece;
+    uint32_t length;
+    uint32_t width;
+    uint32_t pad;
+    value val;
+};
 
-        // Address of atom below.
-        c = a;
-        while( NULL != c ){
-            printf("d=%-20p", c->down );
-            c = c->right;
-        }
-        printf("\n");
+#define SPILL_WINDOW ((size_t)16 * 1024 * 1024)
 
-        // is this atom a conversion specification?
-        c = a;
-        while( NULL != c ){
-            printf("isconvspec=%-11c", c->is_conversion_specification ? 't' : 'f' );
-            c = c->right;
-        }
-        printf("\n");
+struct spill{
+    size_t threshold;       // 0 disables spilling
+    char *directory;
+    int fd;
+    char *buf;              // serialization buffer
+    size_t used;
+    size_t capacity;
+    bool failed;            // a write failed; see spill_drain()
+};
 
-        // pointer to the ordinary text
-        c = a;
-        while( NULL != c ){
-            printf("o=%-20p", c->ordinary_text );
-            c = c->right;
-        }
-        printf("\n");
+// Shared tables (see ctcreate_shared()).  Any number of threads append
+// to one table at once:  each builds its row privately, in the scratch
+// arena of its default table, then copies it into a single malloc()ed
+// shared_row and pushes that onto a lock-free stack.  ctflush() takes
+// the whole stack in one exchange, orders the rows, and moves them into
+// the ordinary column storage for printing, measuring each column from
+// the cells it drained.
+#define SHARED_MAX_COLUMNS 256
 
-        // pointer to original specification
-        c = a;
-        while( NULL != c ){
-            printf("orig=%-17s", c->original_specification );
-            c = c->right;
-        }
-        printf("\n");
+struct shared_row{
+    struct shared_row *next;
+    uint64_t sequence;      // insertion order
+    int64_t key;
+    uint32_t length;        // pieces
+    struct cell cells[];    // text follows the cells
+};
 
-        // pointer to new specification
-        c = a;
-        while( NULL != c ){
-            printf("new =%-17s", c->new_specification );
-            c = c->right;
-        }
-        printf("\n");
+struct shared{
+    cprintf_order_t order;
+    _Atomic( struct shared_row * ) head;
+    atomic_uint_fast64_t sequence;
+    pthread_mutex_t format_lock;    // held only to compile a new format
+    struct shared_row **sorted;     // ctflush() scratch
+    size_t sorted_capacity;
+};
 
+// Where a table's output goes.  Whatever the sink, output is first
+// assembled into a handful of large chunks and handed over a chunk (or,
+// for a file descriptor, all the chunks in one writev()) at a time.
+typedef enum{
+    SINK_NONE,              // default table between flushes
+    SINK_FILE,
+    SINK_FD,
+    SINK_BUFFER,            // caller's fixed-size buffer, snprintf() style
+    SINK_STRING,            // growing malloc()ed string
+    SINK_CALLBACK
+}sink_kind_t;
 
-        printf("\n");
-        a = a->down;
-    }
-    fflush(NULL);
-}
+struct sink{
+    sink_kind_t kind;
+    FILE *stream;
+    int fd;
+    char *buffer;           // SINK_BUFFER and SINK_STRING
+    size_t size;            // bytes available in buffer
+    size_t length;          // bytes produced so far
+    cprintf_write_fn write;
+    void *context;
+};
 
-void
-_free_graph( struct atom *a ){
-    // Check to see if any graph exists.
-    if( NULL == origin ){
-        return;
-    }
+#define OUTPUT_CHUNK_SIZE ((size_t)64 * 1024)
+#define OUTPUT_CHUNKS 16
 
-    // Starts the process.
-    if( NULL == a ){
-        a = origin;
-    }
+struct output{
+    struct iovec chunks[ OUTPUT_CHUNKS ];
+    size_t current;         // chunk being filled
+};
+
+// Asynchronous flushes (see ctflush_async()).  The rows captured so
+// far are swapped into a detached table, which joins a queue served by
+// a single background writer thread, so tables are written in the
+// order they were handed over.  The caller carries on with the storage
+// of a table detached earlier and already written, so at steady state
+// nothing is allocated.
+struct async{
+    struct ctable *owner;   // detached tables:  the table they serve
+    struct ctable *next;    // writer queue or spares list
+    // The rest are guarded by writer.lock.
+    struct ctable *spares;  // detached tables written and ready for reuse
+    size_t pending;         // detached tables not yet written
+};
+
+// Parallel flushes (see ctthreads()).  Large tables are cut into chunks
+// of rows, and a wave of chunks, one per thread, is padded into
+// in-memory worker tables at once; the flushing thread then writes
+// them out in order and starts the next wave.  Since column widths are
+// settled as cells are captured, the only thing a chunk needs to know
+// is where each of its columns starts, found from the row lengths.
+#define PARALLEL_CHUNK_CELLS ((size_t)256 * 1024)
+
+struct parallel{
+    size_t nthreads;            // 1 is the serial path
+    struct ctable **workers;    // output goes to a growing string
+    struct chunk *chunks;
+    pthread_t *threads;
+    size_t nworkers;
+    size_t *cursors;            // per worker, the next cell of each column
+    size_t cursor_capacity;     // columns per worker
+    size_t cursor_threads;      // workers cursors has room for
+};
+
+// Live tables (see ctlive()).  Each flush pads the table into frame,
+// an in-memory table, noting where every cell starts.  The result is
+// compared with the frame drawn before it, and only cursor movements
+// and the cells that changed are written.  The two frames swap roles
+// at every flush.
+struct frame{
+    char *text;
+    size_t length;
+    size_t size;
+    size_t *starts;             // of each cell in text, then length
+    size_t ncells;
+    size_t *widths;             // of each column
+    size_t ncolumns;
+    size_t capacity;            // of starts and widths
+    bool drawn;
+};
+
+struct live{
+    bool enabled;
+    struct ctable *frame;       // output goes to a growing string
+    struct frame frames[2];
+    int current;                // the one being drawn
+};
+
+// Sorting (see ctsort()).  Each row's keys are taken from its cells
+// once, into nkeys values per row, and rows are compared by those.
+// With top set, rows are picked as they arrive:  a heap of the rows
+// kept so far, worst at the root, turns away a row that can't beat the
+// root, which is taken straight back off the table, or evicts the root
+// to make room for one that can.  Evicted rows are only marked dead.
+// Once SORT_SLACK (or top, if more) rows have gone either way, the
+// table is compacted, and the text of the rows it keeps is copied into
+// a fresh arena so that what the others held is let go.  Memory then
+// follows top rather than the number of rows appended.
+struct sort_value{
+    bool number;                // otherwise a string
+    bool negative;              // integers
+    bool real;                  // floating point
+    bool nan;
+    bool descending;
+    uintmax_t magnitude;        // integers
+    long double x;              // every number
+    const char *text;           // strings, without padding
+    size_t length;
+};
+
+struct sort_row{
+    uint32_t kinds;             // bit k set if key k is a number
+    bool complete;              // has every key
+    bool dead;                  // evicted from the heap
+};
+
+#define SORT_MAX_KEYS 32
+#define SORT_SLACK ((size_t)4096)
+
+struct sort{
+    cprintf_sort_key_t *keys;
+    size_t nkeys;
+    size_t top;
+    struct sort_row *rows;      // one per row taken so far
+    struct sort_value *values;  // nkeys per row
+    size_t capacity;            // of rows, and values over nkeys
+    size_t taken;
+    size_t *at;                 // each column's cell of the row being taken
+    size_t at_capacity;
+    uint32_t pattern;           // kinds of the last complete row
+    bool have_pattern;
+    uint32_t *heap;             // row numbers, worst first
+    size_t nheap;
+    size_t heap_capacity;
+    size_t ndead;               // rows evicted but still in the table
+    size_t dropped;             // rows taken off the table since compaction
+    struct arena arena;         // the next arena, while compacting
+    struct cell *scratch;       // one column, while rearranging
+    size_t scratch_capacity;
+};
+
+// Aggregate footers (see ctfooter()).  Each numeric conversion is
+// added to its column's aggregate as the row is appended, so printing
+// the footers costs nothing more than the rows they add.  Integers are
+// summed exactly; floating point values apart, in long double.  The
+// footer rows take the shape of the last row with a number in it.
+typedef __int128 int128_t;
+
+struct aggregate{
+    uint64_t integers;
+    int128_t sum;
+    int128_t lowest;
+    int128_t highest;
+    uint64_t reals;
+    long double real_sum;
+    long double real_lowest;
+    long double real_highest;
+};
+
+struct footer{
+    int aggregates;             // cprintf_aggregate_t bits
+    bool appending;             // the footer rows themselves
+    struct aggregate *columns;
+    size_t capacity;
+    const struct piece *pieces; // of the last row with a number
+    size_t npieces;
+    const struct piece *kept;   // pieces once copied into arena
+    struct arena arena;         // pieces that outlive their format
+    char *fmt;                  // a footer row's format
+    size_t size;
+    cprintf_arg_t *args;
+    size_t nargs;
+};
+
+// Everything about one table.  Tables share nothing, so each thread
+// can fill its own without locking; the cprintf() family uses a
+// per-thread default table.
+struct ctable{
+    struct sink sink;
+    struct output out;
+    int error;              // errno of the first failed write (cterror())
+
+    // Column and row arrays are grown with realloc() and kept across
+    // flushes, so like the arena they stop allocating at steady state.
+    struct column *columns;
+    size_t ncolumns;        // columns in use
+    size_t column_capacity;
+    uint32_t *row_lengths;  // pieces per row
+    size_t nrows;
+    size_t row_capacity;
+
+    struct arena arena;                 // rendered text
+    struct arena format_arena;          // the format cache
+    struct arena uncached_format_arena;
+    struct format *format_cache[ FORMAT_CACHE_BUCKETS ];
+    size_t format_cache_entries;
+
+    struct streaming streaming;
+    struct spill spill;
+    struct shared *shared;  // NULL unless created by ctcreate_shared()
+
+    // Only used in a thread's default table:  rows that thread is
+    // building for shared tables.
+    struct arena scratch;
+
+    // See ctstats().  Counts are always kept; times only while timing
+    // is on, as reading the clock isn't free.
+    struct{
+        uint64_t rows;
+        uint64_t cells;
+        uint64_t flushes;
+        uint64_t allocations;   // apart from arena blocks
+        uint64_t bytes_written;
+        uint64_t parse_ns;
+        uint64_t measure_ns;
+        uint64_t phase_ns[ CPRINTF_PHASES ];
+        uint64_t phase_start[ CPRINTF_PHASES ];
+    }stats;
+    bool timing;
+    bool dump_stats;        // $CPRINTF_STATS
+    cprintf_hook_fn hook;
+    void *hook_context;
+
+    struct async async;
+    bool detached;          // ever flushed with ctflush_async()
+
+    struct parallel parallel;
+
+    cprintf_export_t form;  // CPRINTF_TEXT except within ctflush_as()
+
+    struct live live;
+
+    bool sticky;
+    struct profile profile;
+
+    struct sort sort;
+    struct footer footer;
+};
+
+static pthread_once_t default_table_once = PTHREAD_ONCE_INIT;
+static pthread_key_t default_table_key;
+static _Thread_local struct ctable *default_table = NULL;
+
+static struct ctable *get_default_table( void );
+static struct ctable *create_table( const struct sink *sink );
 
-    // Find the rightmost atom in the top line.
-    if( a->right ){
-        _free_graph( a->right );
+void *
+arena_alloc( struct arena *arena, size_t size ){
+    // Returns size bytes of zeroed memory aligned for any type.
+    struct arena_block *b = arena->current;
+    size = ( size + sizeof( max_align_t ) - 1 ) & ~( sizeof( max_align_t ) - 1 );
+
+    // Move past blocks that are too full, reusing any left over
+    // from a previous flush cycle.
+    while( NULL != b && b->used + size > b->size ){
+        b = b->next;
+        if( NULL != b ){
+            b->used = 0;
+        }
     }
 
-    // For each atom in the top line, find the last atom in that column.
-    if( a->down ){
-        _free_graph( a->down );
+    if( NULL == b ){
+        size_t bytes = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc( sizeof( struct arena_block ) + bytes );
+        assert(b);
+        arena->held += bytes;
+        arena->blocks++;
+        b->size = bytes;
+        b->used = 0;
+        b->next = NULL;
+        if( NULL == arena->current ){
+            arena->first = b;
+        }else{
+            // Splice in after the current block so that any blocks
+            // further down the chain are still available for reuse.
+            b->next = arena->current->next;
+            arena->current->next = b;
+        }
     }
+    arena->current = b;
 
-    // If we're at the point where we're looking at the atom in the top left
-    // corner, we're done.
-    if( a == origin ){
-        origin = NULL;
+    void *p = (char *)b->data + b->used;
+    b->used += size;
+    arena->allocated += size;
+    memset( p, 0, size );
+    return p;
+}
+
+void
+arena_reset( struct arena *arena ){
+    // Blocks are kept for the next flush cycle.  Only the first one
+    // needs its cursor rewound here; arena_alloc() rewinds the others
+    // as it reaches them.
+    arena->current = arena->first;
+    arena->allocated = 0;
+    if( NULL != arena->first ){
+        arena->first->used = 0;
     }
+    arena->nstrings = 0;
+    arena->epoch++;
+}
 
-    // If there's an atom above us, disconnect from it.
-    if( a->up ){
-        a->up->down = NULL;
+void
+arena_free( struct arena *arena ){
+    struct arena_block *b = arena->first, *next;
+    while( NULL != b ){
+        next = b->next;
+        free( b );
+        b = next;
     }
+    free( arena->strings );
+    arena->first = arena->current = NULL;
+    arena->allocated = 0;
+    arena->held = 0;
+    arena->strings = NULL;
+    arena->string_slots = arena->nstrings = 0;
+}
 
-    // If there's an atom to the left of us, disconnect from it.
-    if( a->left ){
-        a->left->right = NULL;
+void
+dump_table( struct ctable *t ){
+    size_t r, c;
+    for( c = 0; c < t->ncolumns; c++ ){
+        printf("column %zu: cells=%zu capacity=%zu width=%zu\n",
+                c, t->columns[c].ncells, t->columns[c].capacity, t->columns[c].width );
+        t->columns[c].next = 0;
+    }
+    for( r = 0; r < t->nrows; r++ ){
+        printf("row %zu:\n", r );
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            struct cell *cell = &(t->columns[c].cells[ t->columns[c].next++ ]);
+            printf("  [%zu] isconvspec=%c orig=%-17s length=%-5u width=%-5u text=%s\n",
+                    c,
+                    cell->piece->is_conversion_specification ? 't' : 'f',
+                    cell->piece->is_conversion_specification ? cell->piece->original_specification : "",
+                    cell->length,
+                    cell->width,
+                    NULL == cell->text ? "(integer)" : cell->text );
+        }
     }
-    free( a->original_specification );
-    free( a->new_specification );
-    free( a->flags );
-    free( a->field_width );
-    free( a->precision );
-    free( a->length_modifier );
-    free( a->conversion_specifier );
-    free( a->ordinary_text );
-    free( a );
+    fflush(NULL);
+}
 
-    return;
+void
+clear_rows( struct ctable *t ){
+    // Drops every captured row but keeps the column widths.  Nothing
+    // is freed cell by cell:  rendered text lives in the arena and the
+    // column arrays are kept for the next flush cycle.
+    size_t c;
+    for( c = 0; c < t->ncolumns; c++ ){
+        t->columns[c].ncells = 0;
+    }
+    t->nrows = 0;
+    arena_reset( &t->arena );
+    t->sort.taken = t->sort.nheap = t->sort.ndead = t->sort.dropped = 0;
+    t->sort.have_pattern = false;
 }
 
 void
-free_graph(){
-    _free_graph( NULL );
+reset_table( struct ctable *t ){
+    size_t c;
+    clear_rows( t );
+    arena_reset( &t->uncached_format_arena );
+    if( t->sticky ){
+        return;
+    }
+    for( c = 0; c < t->ncolumns; c++ ){
+        t->columns[c].width = 0;
+    }
+    t->ncolumns = 0;
 }
 
-struct atom *
-create_atom( bool is_newline ){
-    static struct atom *last_atom_on_last_line = NULL;
-    static struct atom *first_atom_on_last_line = NULL;
+struct cell *
+append_cell( struct ctable *t, size_t column, const struct piece *piece ){
+    struct column *col;
+    struct cell *cell;
 
-    struct atom *a = calloc( sizeof( struct atom ), 1 );
-    assert(a);
-    
-    // recall the value of NULL is implementation-specific.
-    a->original_specification       = NULL;
-    a->new_specification            = NULL;
-
-    a->flags                        = NULL;
-    a->field_width                  = NULL;
-    a->precision                    = NULL;
-    a->length_modifier              = NULL;
-    a->conversion_specifier         = NULL;
-
-    a->ordinary_text                = NULL;
-    a->pargs                        = NULL;
-
-    a->right                        = NULL;
-    a->left                         = NULL;
-    a->up                           = NULL;
-    a->down                         = NULL;
-
-    if( NULL == origin ){
-        first_atom_on_last_line = origin = a;
-    }else if(is_newline){
-        // new line, only need to set up and down.
-        first_atom_on_last_line->down = a;
-        a->up = first_atom_on_last_line;
-        first_atom_on_last_line = a;
+    if( column >= t->column_capacity ){
+        size_t n = t->column_capacity ? t->column_capacity * 2 : 16;
+        t->columns = realloc( t->columns, n * sizeof( struct column ) );
+        assert( t->columns );
+        t->stats.allocations++;
+        memset( t->columns + t->column_capacity, 0, ( n - t->column_capacity ) * sizeof( struct column ) );
+        t->column_capacity = n;
+    }
+    if( column >= t->ncolumns ){
+        t->ncolumns = column + 1;
+    }
+
+    col = &(t->columns[ column ]);
+    if( col->ncells == col->capacity ){
+        col->capacity = col->capacity ? col->capacity * 2 : 64;
+        col->cells = realloc( col->cells, col->capacity * sizeof( struct cell ) );
+        assert( col->cells );
+        t->stats.allocations++;
+    }
+    cell = &(col->cells[ col->ncells++ ]);
+    cell->piece = piece;
+    cell->pad = 0;
+    if( piece->is_conversion_specification ){
+        cell->text = NULL;
+        cell->length = cell->width = 0;
     }else{
-        // adding to an existing line, need to set
-        // left/right and (maybe) up/down.
-        last_atom_on_last_line->right = a;
-        a->left = last_atom_on_last_line;
-        if(last_atom_on_last_line->up){
-            a->up = last_atom_on_last_line->up->right;
-            last_atom_on_last_line->up->right->down = a;
-        }
+        cell->text = piece->ordinary_text;
+        cell->length = cell->width = piece->ordinary_length;
     }
-    last_atom_on_last_line = a;
-    return a;
+    return cell;
 }
 
 
@@ -338,19 +780,83 @@ ptrdiff_t
 parse_conversion_specifier( const char *p ){
     // conversion specifiers are:
     // d, i, o, u, x, X, e, E, f, F, g, G, a, A, c, C, s, S, p, n, m, %
-    size_t d = strspn( p, "diouxXeEfFgGaAcCsSpnm%" );
-    // This one is mandatory and there can only be one.
-    assert( d==1 );
-    return d;
+    // This one is mandatory and there can only be one.  (strspn() would
+    // also swallow the start of a following "%%".)
+    assert( '\0' != *p && NULL != strchr( "diouxXeEfFgGaAcCsSpnm%", *p ) );
+    return 1;
 }
 
 void
-archive( const char *p, ptrdiff_t span, char **q ){
-    // This will call calloc for null strings (strings with
-    // a length of 0 consisting only of a terminating null).
-    // This allows _free_graph() to be a little dumber.
-    *q = calloc( span+1, 1 );
-    strncpy( *q, p, span );
+archive( struct arena *arena, const char *p, ptrdiff_t span, char **q ){
+    // This will allocate null strings (strings with a length
+    // of 0 consisting only of a terminating null) so that the
+    // rest of the code never has to check for NULL.
+    *q = arena_alloc( arena, span+1 );
+    memcpy( *q, p, span );
+}
+
+static uint32_t
+hash_bytes( const char *p, size_t n ){
+    // FNV-1a.
+    uint32_t h = 2166136261u;
+    while( n-- > 0 ){
+        h = ( h ^ (unsigned char)*p++ ) * 16777619u;
+    }
+    return h;
+}
+
+static void
+grow_strings( struct arena *arena ){
+    // Doubles the intern slots, keeping this epoch's strings.
+    struct interned *old = arena->strings, *slot;
+    size_t n = arena->string_slots, i, mask;
+
+    arena->string_slots = n ? n * 2 : INTERN_SLOTS;
+    arena->strings = calloc( arena->string_slots, sizeof( struct interned ) );
+    assert( arena->strings );
+    arena->held += ( arena->string_slots - n ) * sizeof( struct interned );
+    arena->blocks++;
+    mask = arena->string_slots - 1;
+    for( i = 0; i < n; i++ ){
+        if( NULL != old[i].text && old[i].epoch == arena->epoch ){
+            slot = &(arena->strings[ old[i].hash & mask ]);
+            while( NULL != slot->text ){
+                slot = &(arena->strings[ ( slot - arena->strings + 1 ) & mask ]);
+            }
+            *slot = old[i];
+        }
+    }
+    free( old );
+}
+
+static void
+intern( struct arena *arena, const char *p, size_t length, char **q ){
+    // Like archive(), but hands back the copy already made this flush
+    // cycle if there is one.  Interned text is never written to.
+    uint32_t hash = hash_bytes( p, length );
+    struct interned *slot;
+    size_t mask;
+
+    if( arena->nstrings < INTERN_LIMIT && 2 * ( arena->nstrings + 1 ) > arena->string_slots ){
+        grow_strings( arena );
+    }
+    mask = arena->string_slots - 1;
+    slot = &(arena->strings[ hash & mask ]);
+    while( NULL != slot->text && slot->epoch == arena->epoch ){
+        if( slot->hash == hash && slot->length == length && 0 == memcmp( slot->text, p, length ) ){
+            *q = (char *)slot->text;
+            return;
+        }
+        slot = &(arena->strings[ ( slot - arena->strings + 1 ) & mask ]);
+    }
+    archive( arena, p, length, q );
+    if( arena->nstrings < INTERN_LIMIT ){
+        slot->text = *q;
+        slot->length = length;
+        slot->hash = hash;
+        slot->epoch = arena->epoch;
+        arena->nstrings++;
+    }
 }
 
 bool
@@ -361,365 +867,5165 @@ is( char *p, const char *q ){
     size_t lenq = strlen( q );
     return lenp == lenq ? (bool) ! strncmp( p, q, lenq ) : false;
 }
-static void
-calc_actual_width( struct atom *a ){
-    // FIXME Not (yet) supporting 'n' as a conversion specifier.
-    // Reproduces the big table at 
-    // https://en.cppreference.com/w/c/io/fprintf
-/*
-    length      conversion
-    modifier    specifier       type
-    --------------------------------
-    (none)      c               int
-    l           c               wint_t
-    (none)      s               char*
-    l           s               wchar_t*
-    hh          d/i             signed char [int]
-    h           d/i             short [int]
-    (none)      d/i             int
-    l           d/i             long
-    ll          d/i             long long
-    j           d/i             intmax_t
-    z           d/i             signed size_t [ssize_t]
-    t           d/i             ptrdiff_t
-    hh          o/x/X/u         unsigned char [int]
-    h           o/x/X/u         unsigned short [int]
-    (none)      o/x/X/u         unsigned int
-    l           o/x/X/u         unsigned long
-    ll          o/x/X/u         unsigned long long
-    j           o/x/X/u         uintmax_t
-    z           o/x/X/u         size_t
-    t           o/x/X/u         unsigned ptrdiff_t [?]
-    (none)/l    f/F/e/E/a/A/g/G double
-    L           f/F/e/E/a/A/g/G long double
-    (none)      p               void*
-*/
-    static char buf[4097]; 
-    if( is(a->conversion_specifier, "c") ){
-        if( is( a->length_modifier, "" ) ){
-            a->type = C_INT;
-            a->val.c_int = va_arg( *(a->pargs), int );
-            snprintf( buf, 4096, a->original_specification, a->val.c_int );
-        }else if( is( a->length_modifier, "l" ) ){
-            a->type = C_WINT_T;
-            a->val.c_wint_t = va_arg( *(a->pargs), wint_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_wint_t );
-        }else{
-            assert(0);
-        }
-    }else if( is(a->conversion_specifier, "s") ){
-        if( is( a->length_modifier, "" ) ){
-            a->type = C_CHARX;
-            a->val.c_charx = va_arg( *(a->pargs), char* );
-            snprintf( buf, 4096, a->original_specification, a->val.c_charx );
-        }else if( is( a->length_modifier, "l" ) ){
-            a->type = C_WCHAR_TX;
-            a->val.c_wchar_tx = va_arg( *(a->pargs), wchar_t* );
-            snprintf( buf, 4096, a->original_specification, a->val.c_wchar_tx );
-        }else{
-            assert(0);
-        }
-    }else if( is(a->conversion_specifier, "d") 
-          ||  is(a->conversion_specifier, "i") ){
-        if( is( a->length_modifier, "hh" ) 
-        ||  is( a->length_modifier, "h" ) 
-        ||  is( a->length_modifier, "" ) ){
-            a->type = C_INT;
-            a->val.c_int = va_arg( *(a->pargs), int );
-            snprintf( buf, 4096, a->original_specification, a->val.c_int );
-        }else if( is( a->length_modifier, "l" ) ){
-            a->type = C_LONG;
-            a->val.c_long = va_arg( *(a->pargs), long );
-            snprintf( buf, 4096, a->original_specification, a->val.c_long );
-        }else if( is( a->length_modifier, "ll" ) ){
-            a->type = C_LONG_LONG;
-            a->val.c_long_long = va_arg( *(a->pargs), long long );
-            snprintf( buf, 4096, a->original_specification, a->val.c_long_long );
-        }else if( is( a->length_modifier, "j" ) ){
-            a->type = C_INTMAX_T;
-            a->val.c_intmax_t = va_arg( *(a->pargs), intmax_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_intmax_t );
-        }else if( is( a->length_modifier, "z" ) ){
-            a->type = C_SSIZE_T;
-            a->val.c_ssize_t = va_arg( *(a->pargs), ssize_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_ssize_t );
-        }else if( is( a->length_modifier, "t" ) ){
-            a->type = C_PTRDIFF_T;
-            a->val.c_ptrdiff_t = va_arg( *(a->pargs), ptrdiff_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_ptrdiff_t );
-        }else{
-            assert(0);
-        }
-    }else if( is(a->conversion_specifier, "o") 
-          ||  is(a->conversion_specifier, "x") 
-          ||  is(a->conversion_specifier, "X") 
-          ||  is(a->conversion_specifier, "u") ){
-        if( is( a->length_modifier, "hh" ) 
-        ||  is( a->length_modifier, "h" ) ){
-            a->type = C_INT;
-            a->val.c_int = va_arg( *(a->pargs), int );
-            snprintf( buf, 4096, a->original_specification, a->val.c_int );
-        }else if( is( a->length_modifier, "" ) ){
-            a->type = C_UNSIGNED_INT;
-            a->val.c_unsigned_int = va_arg( *(a->pargs), unsigned int );
-            snprintf( buf, 4096, a->original_specification, a->val.c_unsigned_int );
-        }else if( is( a->length_modifier, "l" ) ){
-            a->type = C_UNSIGNED_LONG;
-            a->val.c_unsigned_long = va_arg( *(a->pargs), unsigned long );
-            snprintf( buf, 4096, a->original_specification, a->val.c_unsigned_long );
-        }else if( is( a->length_modifier, "ll" ) ){
-            a->type = C_UNSIGNED_LONG_LONG;
-            a->val.c_unsigned_long_long = va_arg( *(a->pargs), unsigned long long );
-            snprintf( buf, 4096, a->original_specification, a->val.c_unsigned_long_long );
-        }else if( is( a->length_modifier, "j" ) ){
-            a->type = C_UINTMAX_T;
-            a->val.c_uintmax_t = va_arg( *(a->pargs), uintmax_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_uintmax_t );
-        }else if( is( a->length_modifier, "z" ) ){
-            a->type = C_SIZE_T;
-            a->val.c_size_t = va_arg( *(a->pargs), size_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_size_t );
-        }else if( is( a->length_modifier, "t" ) ){
-            a->type = C_PTRDIFF_T;
-            a->val.c_ptrdiff_t = va_arg( *(a->pargs), ptrdiff_t );
-            snprintf( buf, 4096, a->original_specification, a->val.c_ptrdiff_t );
-        }else{
-            assert(0);
-        }
-    }else if( is(a->conversion_specifier, "f") 
-          ||  is(a->conversion_specifier, "F") 
-          ||  is(a->conversion_specifier, "e") 
-          ||  is(a->conversion_specifier, "E") 
-          ||  is(a->conversion_specifier, "a") 
-          ||  is(a->conversion_specifier, "A") 
-          ||  is(a->conversion_specifier, "g") 
-          ||  is(a->conversion_specifier, "G") ){
-        if( is( a->length_modifier, "l" )
-        ||  is( a->length_modifier, "" ) ){
-            a->type = C_DOUBLE;
-            a->val.c_double = va_arg( *(a->pargs), double );
-            snprintf( buf, 4096, a->original_specification, a->val.c_double );
-        }else if( is( a->length_modifier, "L" ) ){
-            a->type = C_LONG_DOUBLE;
-            a->val.c_long_double = va_arg( *(a->pargs), long double );
-            snprintf( buf, 4096, a->original_specification, a->val.c_long_double );
-        }else{
-            assert(0);
-        }
-    }else if( is(a->conversion_specifier, "p") ){
-        if( is( a->length_modifier, "" ) ){
-            a->type = C_VOIDX;
-            a->val.c_voidx = va_arg( *(a->pargs), void* );
-            snprintf( buf, 4096, a->original_specification, a->val.c_voidx );
-        }else{
-            assert(0);
-        }
-    }else{
-        assert(0);
+static int
+format_value( char *buf, size_t n, const char *spec, type_t type, value *val ){
+    switch( type ){
+        case C_INT:                 return snprintf( buf, n, spec, val->c_int );
+        case C_WINT_T:              return snprintf( buf, n, spec, val->c_wint_t );
+        case C_CHARX:               return snprintf( buf, n, spec, val->c_charx );
+        case C_WCHAR_TX:            return snprintf( buf, n, spec, val->c_wchar_tx );
+        case C_LONG:                return snprintf( buf, n, spec, val->c_long );
+        case C_LONG_LONG:           return snprintf( buf, n, spec, val->c_long_long );
+        case C_INTMAX_T:            return snprintf( buf, n, spec, val->c_intmax_t );
+        case C_SSIZE_T:             return snprintf( buf, n, spec, val->c_ssize_t );
+        case C_PTRDIFF_T:           return snprintf( buf, n, spec, val->c_ptrdiff_t );
+        case C_UNSIGNED_INT:        return snprintf( buf, n, spec, val->c_unsigned_int );
+        case C_UNSIGNED_LONG:       return snprintf( buf, n, spec, val->c_unsigned_long );
+        case C_UNSIGNED_LONG_LONG:  return snprintf( buf, n, spec, val->c_unsigned_long_long );
+        case C_UINTMAX_T:           return snprintf( buf, n, spec, val->c_uintmax_t );
+        case C_SIZE_T:              return snprintf( buf, n, spec, val->c_size_t );
+        case C_DOUBLE:              return snprintf( buf, n, spec, val->c_double );
+        case C_LONG_DOUBLE:         return snprintf( buf, n, spec, val->c_long_double );
+        case C_VOIDX:               return snprintf( buf, n, spec, val->c_voidx );
+        default:
+                                    assert(0);
+                                    return -1;
     }
-    assert( strnlen(buf, 4096) < 4095 );
-    a->original_field_width = strlen( buf );
 }
 
-void
-calc_max_width(){
-    struct atom *a = origin, *c;
-    assert( NULL != a );
-    size_t w = 0;
-    while( NULL != a ){
-        if( a->is_conversion_specification ){
-            c = a;
-            while( NULL != c ){
-                // find max field width
-                if( c->original_field_width > w ){
-                    w = c->original_field_width;
-                }
-                c = c->down;
+// The integer kernels.  A value is broken into an optional prefix
+// (sign or 0x), zeros from the precision, and its digits; the lengths
+// are pure arithmetic, and the digits are written back to front
+// directly into the output buffer.
+_Static_assert( sizeof( uintmax_t ) == sizeof( unsigned long long ), "count_digits() assumes 64-bit uintmax_t" );
+
+struct integer{
+    uintmax_t magnitude;
+    char prefix[2];
+    size_t prefix_length;
+    size_t zeros;
+    size_t digits;
+};
+
+static const uintmax_t powers_of_ten[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const char decimal_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static unsigned int
+count_digits( uintmax_t v, unsigned int base ){
+    // Zero has one digit.  Setting the low bit never carries v past a
+    // power of ten (they're all even), so that handles zero for free.
+    unsigned int bits, t;
+    v |= 1;
+    bits = 64 - __builtin_clzll( v );
+    switch( base ){
+        case 16:    return ( bits + 3 ) / 4;
+        case 8:     return ( bits + 2 ) / 3;
+        default:
+            // log10(2) ~= 1233/4096, which is exact enough for 64 bits.
+            t = bits * 1233 >> 12;
+            return t + ( v >= powers_of_ten[t] );
+    }
+}
+
+static void
+write_digits( char *end, uintmax_t v, const struct piece *piece, size_t digits ){
+    // Fills the digits bytes ending just before end.
+    const char *hex = piece->uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    switch( piece->base ){
+        case 16:
+            while( digits-- > 0 ){ *--end = hex[ v & 0xf ]; v >>= 4; }
+            break;
+        case 8:
+            while( digits-- > 0 ){ *--end = '0' + ( v & 0x7 ); v >>= 3; }
+            break;
+        default:
+            while( digits >= 2 ){
+                end -= 2;
+                memcpy( end, &decimal_pairs[ 2 * ( v % 100 ) ], 2 );
+                v /= 100;
+                digits -= 2;
             }
-            c = a;
-            while( NULL != c){
-                // set max field width
-                c->new_field_width = w;
-                c = c->down;
+            if( digits > 0 ){
+                *--end = '0' + v;
             }
-            w = 0;
-        }
-        a = a->right;
+            break;
     }
 }
 
-void
-generate_new_specs(){
-    char buf[4099];
-    int rc;
-    struct atom *a = origin, *c;
-    assert( NULL != a );
-    while( NULL != a ){
-        if( a->is_conversion_specification ){
-            c = a;
-            while( NULL != c ){
-                rc = snprintf(buf, 4099, "%%%s%zu%s%s%s",
-                        c->flags,
-                        c->new_field_width,
-                        c->precision,
-                        c->length_modifier,
-                        c->conversion_specifier);
-                assert( rc < 4099 );
-                archive( buf, strlen(buf), &(c->new_specification));
-                c = c->down;
-            }
-        }
-        a = a->right;
-    }
-}
-
-void
-print_something_already(){
-    struct atom *a = origin, *c;
-    assert( NULL != a );
-    while( NULL != a ){
-        c = a;
-        while( NULL != c ){
-            if( c->is_conversion_specification ){
-                switch( c->type ){
-                    case C_INT:                 fprintf( dest, c->new_specification, c->val.c_int );                break;
-                    case C_WINT_T:              fprintf( dest, c->new_specification, c->val.c_wint_t );             break;
-                    case C_CHARX:               fprintf( dest, c->new_specification, c->val.c_charx );              break;
-                    case C_WCHAR_TX:            fprintf( dest, c->new_specification, c->val.c_wchar_tx );           break;
-                    case C_LONG:                fprintf( dest, c->new_specification, c->val.c_long );               break;
-                    case C_LONG_LONG:           fprintf( dest, c->new_specification, c->val.c_long_long );          break;
-                    case C_INTMAX_T:            fprintf( dest, c->new_specification, c->val.c_intmax_t );           break;
-                    case C_SSIZE_T:             fprintf( dest, c->new_specification, c->val.c_ssize_t );            break;
-                    case C_PTRDIFF_T:           fprintf( dest, c->new_specification, c->val.c_ptrdiff_t );          break;
-                    case C_UNSIGNED_INT:        fprintf( dest, c->new_specification, c->val.c_unsigned_int );       break;
-                    case C_UNSIGNED_LONG:       fprintf( dest, c->new_specification, c->val.c_unsigned_long );      break;
-                    case C_UNSIGNED_LONG_LONG:  fprintf( dest, c->new_specification, c->val.c_unsigned_long_long ); break;
-                    case C_UINTMAX_T:           fprintf( dest, c->new_specification, c->val.c_uintmax_t );          break;
-                    case C_SIZE_T:              fprintf( dest, c->new_specification, c->val.c_size_t );             break;
-                    case C_DOUBLE:              fprintf( dest, c->new_specification, c->val.c_double );             break;
-                    case C_LONG_DOUBLE:         fprintf( dest, c->new_specification, c->val.c_long_double );        break;
-                    case C_VOIDX:               fprintf( dest, c->new_specification, c->val.c_voidx );              break;
-                    default:
-                                                assert(0);
-                                                break;
-                }
-            }else{
-                printf( "%s", c->ordinary_text );
-            }
-            c = c->right;
+static uintmax_t
+integer_magnitude( const struct piece *piece, const value *val, bool *negative ){
+    // Applies the same conversions printf() does (hh and h values are
+    // narrowed, t is unsigned for o, u, x and X) and splits off the sign.
+    intmax_t s;
+    uintmax_t u;
+    *negative = false;
+    if( piece->is_signed ){
+        switch( piece->type ){
+            case C_INT:
+                s = 1 == piece->narrow ? (signed char)val->c_int
+                  : 2 == piece->narrow ? (short)val->c_int
+                  : val->c_int;
+                break;
+            case C_LONG:        s = val->c_long;        break;
+            case C_LONG_LONG:   s = val->c_long_long;   break;
+            case C_INTMAX_T:    s = val->c_intmax_t;    break;
+            case C_SSIZE_T:     s = val->c_ssize_t;     break;
+            case C_PTRDIFF_T:   s = val->c_ptrdiff_t;   break;
+            default:            assert(0);              return 0;
+        }
+        if( s < 0 ){
+            *negative = true;
+            return (uintmax_t)0 - (uintmax_t)s;
         }
-        a = a->down;
+        return s;
     }
+    switch( piece->type ){
+        case C_INT:
+            u = 1 == piece->narrow ? (unsigned char)val->c_int : (unsigned short)val->c_int;
+            break;
+        case C_UNSIGNED_INT:        u = val->c_unsigned_int;        break;
+        case C_UNSIGNED_LONG:       u = val->c_unsigned_long;       break;
+        case C_UNSIGNED_LONG_LONG:  u = val->c_unsigned_long_long;  break;
+        case C_UINTMAX_T:           u = val->c_uintmax_t;           break;
+        case C_SIZE_T:              u = val->c_size_t;              break;
+        case C_PTRDIFF_T:           u = (size_t)val->c_ptrdiff_t;   break;
+        default:                    assert(0);                      return 0;
+    }
+    return u;
 }
 
-void
-_cprintf( FILE *stream, const char *fmt, va_list *args ){
-    struct atom *a;
-    const char *p = fmt, *q = fmt;
-    ptrdiff_t d = 0;
-    ptrdiff_t span;
-    /* There's a reasonable argument that newlines should be indicated by
-       '\n' in the ordinary text, which would allow successive calls to 
-       cprintf() to populate a single line.  This raises, however, the
-       question of what to do with cprintf("\n\n") and similar.  For now,
-       keep parsing easy.
-    */
-    bool is_newline = true;
-
-    if( dest == NULL ){
-        dest = stream;
+static size_t
+measure_magnitude( const struct piece *piece, uintmax_t v, bool negative, struct integer *n ){
+    // Returns the length printf() would produce, ignoring the field
+    // width.
+    n->magnitude = v;
+    n->prefix_length = 0;
+    if( negative ){
+        n->prefix[ n->prefix_length++ ] = '-';
+    }else if( piece->is_signed && '\0' != piece->sign ){
+        n->prefix[ n->prefix_length++ ] = piece->sign;
+    }else if( 16 == piece->base && piece->alternate && 0 != v ){
+        n->prefix[ n->prefix_length++ ] = '0';
+        n->prefix[ n->prefix_length++ ] = piece->uppercase ? 'X' : 'x';
     }
-    // This fails if subsequent streams don't match the initial one.
-    assert( dest == stream );
-
-    while( *p != '\0' ){
-        d = strcspn( p, "%" ); 
-        q = p;
-        if( d == 0 ){
-            // We've found a converstion specification.
-            a = create_atom( is_newline );
-            a->pargs = args;
-            a->is_conversion_specification = true;
-
-            q++; // Skip over initial '%'
-
-            span = parse_flags( q );
-            archive( q, span, &(a->flags) );
-            q += span;
-            
-            span = parse_field_width( q );
-            archive( q, span, &(a->field_width) );
-            q += span;
+    // An explicit zero precision prints nothing at all for zero.
+    n->digits = ( 0 == v && 0 == piece->precision_value ) ? 0 : count_digits( v, piece->base );
+    n->zeros = piece->precision_value > (long)n->digits ? piece->precision_value - n->digits : 0;
+    if( 8 == piece->base && piece->alternate && 0 == n->zeros && ( 0 != v || 0 == n->digits ) ){
+        n->zeros = 1;   // '#' makes the first octal digit a zero
+    }
+    return n->prefix_length + n->zeros + n->digits;
+}
 
-            span = parse_precision( q );
-            archive( q, span, &(a->precision) );
-            q += span;
+static size_t
+measure_integer( const struct piece *piece, const value *val, struct integer *n ){
+    bool negative;
+    uintmax_t v = integer_magnitude( piece, val, &negative );
+    return measure_magnitude( piece, v, negative, n );
+}
 
-            span = parse_length_modifier( q );
-            archive( q, span, &(a->length_modifier) );
-            q += span;
+// The floating point kernel.  A finite value is taken apart into an
+// integer mantissa m and binary exponent e, and the decimal digits are
+// the integer round( m * 2^e * 10^k ), computed exactly and rounded
+// half to even as glibc does in the default rounding mode.  Everything
+// is done in 128-bit integers, which covers the precisions and
+// magnitudes tables actually print; values that would need more
+// (very large or very small exponents, long precisions, long double
+// denormals) are handed back to snprintf().
+typedef unsigned __int128 uint128_t;
 
-            span = parse_conversion_specifier( q );
-            archive( q, span, &(a->conversion_specifier) );
-            q += span;
+struct decomposed{
+    bool negative;
+    bool finite;
+    bool nan;
+    bool subnormal;
+    uint64_t m;
+    int e;
+    int mantissa_bits;      // 53 or 64
+};
 
-            archive( p, q-p, &(a->original_specification) ); 
+static uint128_t
+power_of_ten( int k ){
+    // k <= 38
+    return k <= 19 ? (uint128_t)powers_of_ten[k] : (uint128_t)powers_of_ten[19] * powers_of_ten[k-19];
+}
 
-            calc_actual_width( a );
-            a->pargs = NULL;    // cleanup
-            p = q;
+static bool
+decompose( const struct piece *piece, const value *val, struct decomposed *d ){
+    uint64_t bits;
+    unsigned int exponent;
+    d->finite = true;
+    d->nan = false;
+    d->subnormal = false;
+    if( C_DOUBLE == piece->type || LDBL_MANT_DIG == 53 ){
+        double v = C_DOUBLE == piece->type ? val->c_double : (double)val->c_long_double;
+        memcpy( &bits, &v, sizeof( bits ) );
+        d->negative = bits >> 63;
+        exponent = ( bits >> 52 ) & 0x7ff;
+        d->m = bits & ( ( (uint64_t)1 << 52 ) - 1 );
+        d->mantissa_bits = 53;
+        if( 0x7ff == exponent ){
+            d->finite = false;
+            d->nan = 0 != d->m;
+        }else if( 0 == exponent ){
+            d->subnormal = 0 != d->m;
+            d->e = -1074;
         }else{
-            // We've found some normal text.
-            a = create_atom( is_newline );
-            a->is_conversion_specification = false;
-            archive( q, d, &(a->ordinary_text) );
-            q += d;
-            p = q;
+            d->m |= (uint64_t)1 << 52;
+            d->e = (int)exponent - 1075;
         }
-        is_newline = false;
+        return true;
     }
+#if LDBL_MANT_DIG == 64
+    // x87 extended precision:  an explicit 64-bit mantissa followed by
+    // the sign and a 15-bit exponent.
+    uint16_t se;
+    memcpy( &(d->m), &(val->c_long_double), sizeof( d->m ) );
+    memcpy( &se, (const char *)&(val->c_long_double) + sizeof( d->m ), sizeof( se ) );
+    d->negative = se >> 15;
+    exponent = se & 0x7fff;
+    d->mantissa_bits = 64;
+    if( 0x7fff == exponent ){
+        d->finite = false;
+        d->nan = 0 != ( d->m << 1 );
+        return true;
+    }
+    if( 0 == exponent ){
+        d->subnormal = 0 != d->m;
+        d->e = -16445;
+        return true;
+    }
+    d->e = (int)exponent - 16383 - 63;
+    return 0 != ( d->m >> 63 );     // unnormals go to libc
+#else
+    return false;
+#endif
 }
 
-void
-cprintf( const char *fmt, ... ){
-    va_list args;
-    va_start( args, fmt );
-    _cprintf( stdout, fmt, &args );
-    va_end(args);
+static bool
+scale( uint64_t m, int e, int k, uint128_t *n, bool *up ){
+    // *n = round( m * 2^e * 10^k ), ties to even, if that can be done
+    // in 128 bits.  *up says whether rounding went up.
+    uint128_t num = m, den = 1, q, r, half;
+    int s;
+    *up = false;
+    if( k > 38 || k < -38 ){
+        return false;
+    }
+    if( k >= 0 && __builtin_mul_overflow( num, power_of_ten( k ), &num ) ){
+        return false;
+    }
+    if( k < 0 ){
+        den = power_of_ten( -k );
+    }
+    if( e >= 0 ){
+        if( e >= 128 || num > ( ~(uint128_t)0 >> e ) ){
+            return false;
+        }
+        num <<= e;
+    }else if( 1 == den ){
+        // The common case:  a plain shift, no division.
+        s = -e;
+        if( s > 128 || ( 128 == s && num <= (uint128_t)1 << 127 ) ){
+            *n = 0;     // less than half (or exactly half, and 0 is even)
+            return true;
+        }
+        if( 128 == s ){
+            *n = 1;
+            *up = true;
+            return true;
+        }
+        q = num >> s;
+        r = num & ( ( (uint128_t)1 << s ) - 1 );
+        half = (uint128_t)1 << ( s - 1 );
+        *up = r > half || ( r == half && ( q & 1 ) );
+        *n = q + *up;
+        return true;
+    }else{
+        if( -e >= 128 || den > ( ~(uint128_t)0 >> -e ) ){
+            return false;
+        }
+        den <<= -e;
+    }
+    q = num / den;
+    r = num % den;
+    *up = r > den - r || ( r == den - r && ( q & 1 ) );
+    *n = q + *up;
+    return true;
 }
 
-void
-cfprintf( FILE *stream, const char *fmt, ... ){
-    va_list args;
-    va_start( args, fmt );
-    _cprintf( stream, fmt, &args );
-    va_end(args);
-
+static int
+floor_log10_pow2( int x ){
+    // floor( x * log10(2) ), give or take one; the callers correct it.
+    return x >= 0 ? ( x * 78913 ) >> 18 : -( ( -x * 78913 + ( 1 << 18 ) - 1 ) >> 18 );
 }
 
-
-void
+static size_t
+decimal_digits( char *buf, uint128_t n, size_t minimum ){
+    // Writes n in decimal, zero-filled to at least minimum digits, and
+    // returns the number of digits.  buf must hold 40 bytes.
+    char tmp[40], *end = tmp + sizeof( tmp ), *p = end;
+    uint64_t low;
+    int i;
+    while( n > UINT64_MAX ){
+        low = n % powers_of_ten[19];
+        n /= powers_of_ten[19];
+        for( i = 0; i < 19; i++ ){
+            *--p = '0' + low % 10;
+            low /= 10;
+        }
+    }
+    low = n;
+    do{
+        *--p = '0' + low % 10;
+        low /= 10;
+    }while( low > 0 );
+    while( (size_t)( end - p ) < minimum ){
+        *--p = '0';
+    }
+    memcpy( buf, p, end - p );
+    return end - p;
+}
+
+static int
+scientific( const struct decomposed *d, int p, uint128_t *n, bool *carried ){
+    // Finds the decimal exponent x and the p+1 significant digits
+    // round( v * 10^(p-x) ).  *carried says whether rounding pushed the
+    // value up to 10^x.  Returns INT_MIN if out of range.
+    int x;
+    uint128_t low = power_of_ten( p ), high = power_of_ten( p + 1 );
+    bool up;
+    *carried = false;
+    if( 0 == d->m ){
+        *n = 0;
+        return 0;
+    }
+    x = floor_log10_pow2( 63 - __builtin_clzll( d->m ) + d->e );
+    while( true ){
+        if( !scale( d->m, d->e, p - x, n, &up ) ){
+            return INT_MIN;
+        }
+        if( *n >= high ){
+            x++;
+        }else if( *n < low ){
+            x--;
+        }else{
+            *carried = up && *n == low;
+            return x;
+        }
+    }
+}
+
+static size_t
+fixed_body( char *q, const struct piece *piece, const char *digits, size_t ndigits, int precision ){
+    // digits holds at least precision+1 digits; the last precision of
+    // them follow the decimal point.
+    size_t whole = ndigits - precision;
+    char *start = q;
+    memcpy( q, digits, whole );
+    q += whole;
+    if( precision > 0 || piece->alternate ){
+        *q++ = '.';
+    }
+    memcpy( q, digits + whole, precision );
+    return q + precision - start;
+}
+
+static size_t
+exponent_suffix( char *q, char e, int x, unsigned int minimum ){
+    char *start = q;
+    char tmp[8];
+    size_t n;
+    *q++ = e;
+    *q++ = x < 0 ? '-' : '+';
+    n = decimal_digits( tmp, (uint128_t)( x < 0 ? -x : x ), minimum );
+    memcpy( q, tmp, n );
+    return q + n - start;
+}
+
+static size_t
+strip_zeros( char *body, size_t length ){
+    // %g without '#':  drop trailing zeros after the point, then the
+    // point itself.
+    if( NULL == memchr( body, '.', length ) ){
+        return length;
+    }
+    while( '0' == body[ length-1 ] ){
+        length--;
+    }
+    if( '.' == body[ length-1 ] ){
+        length--;
+    }
+    return length;
+}
+
+static int
+hexadecimal_body( char *q, const struct piece *piece, const struct decomposed *d ){
+    // glibc prints doubles as 1.hhh (0.hhh when subnormal) and x87 long
+    // doubles with the top four mantissa bits as the leading digit.
+    // Rounding a double can leave a leading 2; a long double is
+    // renormalized instead.
+    const char *hex = piece->uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    int fraction_digits = 64 == d->mantissa_bits ? 15 : 13;
+    int p = piece->precision_value, x, drop, i;
+    uint64_t m = d->m, half, r, lead = 0;
+    char *start = q;
+
+    if( 0 == m ){
+        x = 0;
+    }else if( d->subnormal ){
+        if( 64 == d->mantissa_bits || ( p >= 0 && p < fraction_digits ) ){
+            return -1;
+        }
+        x = -1022;
+    }else{
+        x = d->e + 4 * fraction_digits;
+    }
+    if( 64 == d->mantissa_bits ){
+        m = m << 4 >> 4;    // top nibble is the leading digit
+    }else{
+        m &= ( (uint64_t)1 << 52 ) - 1;
+    }
+    if( 0 != d->m && !d->subnormal ){
+        lead = d->m >> ( 4 * fraction_digits );
+    }
+    if( p < 0 ){
+        // As many digits as it takes.
+        p = fraction_digits;
+        while( p > 0 && 0 == ( ( m >> ( 4 * ( fraction_digits - p ) ) ) & 0xf ) ){
+            p--;
+        }
+    }else if( p < fraction_digits ){
+        drop = 4 * ( fraction_digits - p );
+        r = m & ( ( (uint64_t)1 << drop ) - 1 );
+        half = (uint64_t)1 << ( drop - 1 );
+        m >>= drop;
+        if( r > half || ( r == half && ( ( 0 == p ? lead : m ) & 1 ) ) ){
+            m++;
+            if( m >> ( 4 * p ) ){
+                m = 0;
+                lead++;
+                if( 0x10 == lead ){
+                    lead = 1;
+                    x += 4;
+                }
+            }
+        }
+        m <<= drop;
+    }
+    *q++ = '0';
+    *q++ = piece->uppercase ? 'X' : 'x';
+    *q++ = hex[ lead ];
+    if( p > 0 || piece->alternate ){
+        *q++ = '.';
+    }
+    for( i = 0; i < p; i++ ){
+        *q++ = i < fraction_digits ? hex[ ( m >> ( 4 * ( fraction_digits - 1 - i ) ) ) & 0xf ] : '0';
+    }
+    return q - start + exponent_suffix( q, piece->uppercase ? 'P' : 'p', x, 1 );
+}
+
+static int
+format_float( char *buf, size_t size, const struct piece *piece, const value *val ){
+    // Formats the value the way snprintf() would, field width included,
+    // or returns -1 to have snprintf() do it.
+    struct decomposed d;
+    char body[128], digits[40], *q = buf;
+    int p = piece->precision_value, x;
+    size_t length, ndigits, pad, offset;
+    uint128_t n;
+    bool carried;
+
+    if( !decompose( piece, val, &d ) ){
+        return -1;
+    }
+    if( d.negative ){
+        *q++ = '-';
+    }else if( '\0' != piece->sign ){
+        *q++ = piece->sign;
+    }
+    offset = q - buf;
+    if( !d.finite ){
+        memcpy( body, d.nan ? ( piece->uppercase ? "NAN" : "nan" ) : ( piece->uppercase ? "INF" : "inf" ), 3 );
+        length = 3;
+    }else{
+        switch( piece->style ){
+            case 'f':
+                p = p < 0 ? 6 : p;
+                if( p > 38 || !scale( d.m, d.e, p, &n, &carried ) ){
+                    return -1;
+                }
+                ndigits = decimal_digits( digits, n, p + 1 );
+                length = fixed_body( body, piece, digits, ndigits, p );
+                break;
+            case 'e':
+                p = p < 0 ? 6 : p;
+                if( p > 37 || INT_MIN == ( x = scientific( &d, p, &n, &carried ) ) ){
+                    return -1;
+                }
+                decimal_digits( digits, n, p + 1 );
+                length = fixed_body( body, piece, digits, p + 1, p );
+                length += exponent_suffix( body + length, piece->uppercase ? 'E' : 'e', x, 2 );
+                break;
+            case 'g':
+                p = p < 0 ? 6 : 0 == p ? 1 : p;
+                if( p > 34 || INT_MIN == ( x = scientific( &d, p - 1, &n, &carried ) ) ){
+                    return -1;
+                }
+                if( x < p && x >= -4 ){
+                    // The same digits, printed as %f with precision p-1-x.
+                    ndigits = decimal_digits( digits, n, p - x );
+                    length = fixed_body( body, piece, digits, ndigits, p - 1 - x );
+                    if( !piece->alternate ){
+                        length = strip_zeros( body, length );
+                    }
+                }else if( x == p && carried ){
+                    // glibc picks %f from the unrounded value, and when
+                    // rounding then carries into an extra digit it
+                    // prints a bare "1." (this only shows with '#').
+                    length = fixed_body( body, piece, "1", 1, 0 );
+                    length += exponent_suffix( body + length, piece->uppercase ? 'E' : 'e', x, 2 );
+                }else{
+                    decimal_digits( digits, n, p );
+                    length = fixed_body( body, piece, digits, p, p - 1 );
+                    if( !piece->alternate ){
+                        length = strip_zeros( body, length );
+                    }
+                    length += exponent_suffix( body + length, piece->uppercase ? 'E' : 'e', x, 2 );
+                }
+                break;
+            default:
+                if( p > 64 || ( x = hexadecimal_body( body, piece, &d ) ) < 0 ){
+                    return -1;
+                }
+                length = x;
+                if( d.finite ){
+                    offset += 2;    // zeros go after the 0x
+                }
+                break;
+        }
+    }
+    if( q - buf + length + piece->minimum_width >= size ){
+        return -1;
+    }
+    memcpy( q, body, length );
+    length += q - buf;
+
+    // The field width, as decode_padding() and zero_pad_offset() have it.
+    if( length < piece->minimum_width ){
+        pad = piece->minimum_width - length;
+        if( PAD_RIGHT == piece->padding ){
+            memset( buf + length, ' ', pad );
+        }else{
+            if( PAD_LEFT == piece->padding || !d.finite ){
+                offset = 0;
+            }
+            memmove( buf + offset + pad, buf + offset, length - offset );
+            memset( buf + offset, PAD_ZERO == piece->padding && d.finite ? '0' : ' ', pad );
+        }
+        length += pad;
+    }
+    return length;
+}
+
+// Display width.  Columns are lined up in terminal columns, not bytes:
+// text is taken to be UTF-8, combining marks and other zero-width
+// characters take no room, and East Asian wide and fullwidth
+// characters take two columns.  The tables below are ranges of code
+// points from Unicode 14.0 (general categories Mn, Me and Cf other
+// than the soft hyphen, plus Hangul medial vowels and final consonants;
+// and East Asian Width W and F), merging ranges across short runs of
+// unassigned code points.  Most cells are pure ASCII, one column per
+// byte, and are recognized several bytes at a time without decoding.
+struct interval{
+    uint32_t first;
+    uint32_t last;
+};
+
+static const struct interval zero_width[] = {
+    { 0x00300, 0x0036F }, { 0x00483, 0x00489 }, { 0x00591, 0x005BD },
+    { 0x005BF, 0x005BF }, { 0x005C1, 0x005C2 }, { 0x005C4, 0x005C5 },
+    { 0x005C7, 0x005C7 }, { 0x00600, 0x00605 }, { 0x00610, 0x0061A },
+    { 0x0061C, 0x0061C }, { 0x0064B, 0x0065F }, { 0x00670, 0x00670 },
+    { 0x006D6, 0x006DD }, { 0x006DF, 0x006E4 }, { 0x006E7, 0x006E8 },
+    { 0x006EA, 0x006ED }, { 0x0070F, 0x0070F }, { 0x00711, 0x00711 },
+    { 0x00730, 0x0074A }, { 0x007A6, 0x007B0 }, { 0x007EB, 0x007F3 },
+    { 0x007FD, 0x007FD }, { 0x00816, 0x00819 }, { 0x0081B, 0x00823 },
+    { 0x00825, 0x00827 }, { 0x00829, 0x0082D }, { 0x00859, 0x0085B },
+    { 0x00890, 0x0089F }, { 0x008CA, 0x00902 }, { 0x0093A, 0x0093A },
+    { 0x0093C, 0x0093C }, { 0x00941, 0x00948 }, { 0x0094D, 0x0094D },
+    { 0x00951, 0x00957 }, { 0x00962, 0x00963 }, { 0x00981, 0x00981 },
+    { 0x009BC, 0x009BC }, { 0x009C1, 0x009C4 }, { 0x009CD, 0x009CD },
+    { 0x009E2, 0x009E3 }, { 0x009FE, 0x00A02 }, { 0x00A3C, 0x00A3C },
+    { 0x00A41, 0x00A51 }, { 0x00A70, 0x00A71 }, { 0x00A75, 0x00A75 },
+    { 0x00A81, 0x00A82 }, { 0x00ABC, 0x00ABC }, { 0x00AC1, 0x00AC8 },
+    { 0x00ACD, 0x00ACD }, { 0x00AE2, 0x00AE3 }, { 0x00AFA, 0x00B01 },
+    { 0x00B3C, 0x00B3C }, { 0x00B3F, 0x00B3F }, { 0x00B41, 0x00B44 },
+    { 0x00B4D, 0x00B56 }, { 0x00B62, 0x00B63 }, { 0x00B82, 0x00B82 },
+    { 0x00BC0, 0x00BC0 }, { 0x00BCD, 0x00BCD }, { 0x00C00, 0x00C00 },
+    { 0x00C04, 0x00C04 }, { 0x00C3C, 0x00C3C }, { 0x00C3E, 0x00C40 },
+    { 0x00C46, 0x00C56 }, { 0x00C62, 0x00C63 }, { 0x00C81, 0x00C81 },
+    { 0x00CBC, 0x00CBC }, { 0x00CBF, 0x00CBF }, { 0x00CC6, 0x00CC6 },
+    { 0x00CCC, 0x00CCD }, { 0x00CE2, 0x00CE3 }, { 0x00D00, 0x00D01 },
+    { 0x00D3B, 0x00D3C }, { 0x00D41, 0x00D44 }, { 0x00D4D, 0x00D4D },
+    { 0x00D62, 0x00D63 }, { 0x00D81, 0x00D81 }, { 0x00DCA, 0x00DCA },
+    { 0x00DD2, 0x00DD6 }, { 0x00E31, 0x00E31 }, { 0x00E34, 0x00E3A },
+    { 0x00E47, 0x00E4E }, { 0x00EB1, 0x00EB1 }, { 0x00EB4, 0x00EBC },
+    { 0x00EC8, 0x00ECD }, { 0x00F18, 0x00F19 }, { 0x00F35, 0x00F35 },
+    { 0x00F37, 0x00F37 }, { 0x00F39, 0x00F39 }, { 0x00F71, 0x00F7E },
+    { 0x00F80, 0x00F84 }, { 0x00F86, 0x00F87 }, { 0x00F8D, 0x00FBC },
+    { 0x00FC6, 0x00FC6 }, { 0x0102D, 0x01030 }, { 0x01032, 0x01037 },
+    { 0x01039, 0x0103A }, { 0x0103D, 0x0103E }, { 0x01058, 0x01059 },
+    { 0x0105E, 0x01060 }, { 0x01071, 0x01074 }, { 0x01082, 0x01082 },
+    { 0x01085, 0x01086 }, { 0x0108D, 0x0108D }, { 0x0109D, 0x0109D },
+    { 0x01160, 0x011FF }, { 0x0135D, 0x0135F }, { 0x01712, 0x01714 },
+    { 0x01732, 0x01733 }, { 0x01752, 0x01753 }, { 0x01772, 0x01773 },
+    { 0x017B4, 0x017B5 }, { 0x017B7, 0x017BD }, { 0x017C6, 0x017C6 },
+    { 0x017C9, 0x017D3 }, { 0x017DD, 0x017DD }, { 0x0180B, 0x0180F },
+    { 0x01885, 0x01886 }, { 0x018A9, 0x018A9 }, { 0x01920, 0x01922 },
+    { 0x01927, 0x01928 }, { 0x01932, 0x01932 }, { 0x01939, 0x0193B },
+    { 0x01A17, 0x01A18 }, { 0x01A1B, 0x01A1B }, { 0x01A56, 0x01A56 },
+    { 0x01A58, 0x01A60 }, { 0x01A62, 0x01A62 }, { 0x01A65, 0x01A6C },
+    { 0x01A73, 0x01A7F }, { 0x01AB0, 0x01ACE }, { 0x01B00, 0x01B03 },
+    { 0x01B34, 0x01B34 }, { 0x01B36, 0x01B3A }, { 0x01B3C, 0x01B3C },
+    { 0x01B42, 0x01B42 }, { 0x01B6B, 0x01B73 }, { 0x01B80, 0x01B81 },
+    { 0x01BA2, 0x01BA5 }, { 0x01BA8, 0x01BA9 }, { 0x01BAB, 0x01BAD },
+    { 0x01BE6, 0x01BE6 }, { 0x01BE8, 0x01BE9 }, { 0x01BED, 0x01BED },
+    { 0x01BEF, 0x01BF1 }, { 0x01C2C, 0x01C33 }, { 0x01C36, 0x01C37 },
+    { 0x01CD0, 0x01CD2 }, { 0x01CD4, 0x01CE0 }, { 0x01CE2, 0x01CE8 },
+    { 0x01CED, 0x01CED }, { 0x01CF4, 0x01CF4 }, { 0x01CF8, 0x01CF9 },
+    { 0x01DC0, 0x01DFF }, { 0x0200B, 0x0200F }, { 0x0202A, 0x0202E },
+    { 0x02060, 0x0206F }, { 0x020D0, 0x020F0 }, { 0x02CEF, 0x02CF1 },
+    { 0x02D7F, 0x02D7F }, { 0x02DE0, 0x02DFF }, { 0x0302A, 0x0302D },
+    { 0x03099, 0x0309A }, { 0x0A66F, 0x0A672 }, { 0x0A674, 0x0A67D },
+    { 0x0A69E, 0x0A69F }, { 0x0A6F0, 0x0A6F1 }, { 0x0A802, 0x0A802 },
+    { 0x0A806, 0x0A806 }, { 0x0A80B, 0x0A80B }, { 0x0A825, 0x0A826 },
+    { 0x0A82C, 0x0A82C }, { 0x0A8C4, 0x0A8C5 }, { 0x0A8E0, 0x0A8F1 },
+    { 0x0A8FF, 0x0A8FF }, { 0x0A926, 0x0A92D }, { 0x0A947, 0x0A951 },
+    { 0x0A980, 0x0A982 }, { 0x0A9B3, 0x0A9B3 }, { 0x0A9B6, 0x0A9B9 },
+    { 0x0A9BC, 0x0A9BD }, { 0x0A9E5, 0x0A9E5 }, { 0x0AA29, 0x0AA2E },
+    { 0x0AA31, 0x0AA32 }, { 0x0AA35, 0x0AA36 }, { 0x0AA43, 0x0AA43 },
+    { 0x0AA4C, 0x0AA4C }, { 0x0AA7C, 0x0AA7C }, { 0x0AAB0, 0x0AAB0 },
+    { 0x0AAB2, 0x0AAB4 }, { 0x0AAB7, 0x0AAB8 }, { 0x0AABE, 0x0AABF },
+    { 0x0AAC1, 0x0AAC1 }, { 0x0AAEC, 0x0AAED }, { 0x0AAF6, 0x0AAF6 },
+    { 0x0ABE5, 0x0ABE5 }, { 0x0ABE8, 0x0ABE8 }, { 0x0ABED, 0x0ABED },
+    { 0x0D7B0, 0x0D7FF }, { 0x0FB1E, 0x0FB1E }, { 0x0FE00, 0x0FE0F },
+    { 0x0FE20, 0x0FE2F }, { 0x0FEFF, 0x0FEFF }, { 0x0FFF9, 0x0FFFB },
+    { 0x101FD, 0x101FD }, { 0x102E0, 0x102E0 }, { 0x10376, 0x1037A },
+    { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F }, { 0x10AE5, 0x10AE6 },
+    { 0x10D24, 0x10D27 }, { 0x10EAB, 0x10EAC }, { 0x10F46, 0x10F50 },
+    { 0x10F82, 0x10F85 }, { 0x11001, 0x11001 }, { 0x11038, 0x11046 },
+    { 0x11070, 0x11070 }, { 0x11073, 0x11074 }, { 0x1107F, 0x11081 },
+    { 0x110B3, 0x110B6 }, { 0x110B9, 0x110BA }, { 0x110BD, 0x110BD },
+    { 0x110C2, 0x110CD }, { 0x11100, 0x11102 }, { 0x11127, 0x1112B },
+    { 0x1112D, 0x11134 }, { 0x11173, 0x11173 }, { 0x11180, 0x11181 },
+    { 0x111B6, 0x111BE }, { 0x111C9, 0x111CC }, { 0x111CF, 0x111CF },
+    { 0x1122F, 0x11231 }, { 0x11234, 0x11234 }, { 0x11236, 0x11237 },
+    { 0x1123E, 0x1123E }, { 0x112DF, 0x112DF }, { 0x112E3, 0x112EA },
+    { 0x11300, 0x11301 }, { 0x1133B, 0x1133C }, { 0x11340, 0x11340 },
+    { 0x11366, 0x11374 }, { 0x11438, 0x1143F }, { 0x11442, 0x11444 },
+    { 0x11446, 0x11446 }, { 0x1145E, 0x1145E }, { 0x114B3, 0x114B8 },
+    { 0x114BA, 0x114BA }, { 0x114BF, 0x114C0 }, { 0x114C2, 0x114C3 },
+    { 0x115B2, 0x115B5 }, { 0x115BC, 0x115BD }, { 0x115BF, 0x115C0 },
+    { 0x115DC, 0x115DD }, { 0x11633, 0x1163A }, { 0x1163D, 0x1163D },
+    { 0x1163F, 0x11640 }, { 0x116AB, 0x116AB }, { 0x116AD, 0x116AD },
+    { 0x116B0, 0x116B5 }, { 0x116B7, 0x116B7 }, { 0x1171D, 0x1171F },
+    { 0x11722, 0x11725 }, { 0x11727, 0x1172B }, { 0x1182F, 0x11837 },
+    { 0x11839, 0x1183A }, { 0x1193B, 0x1193C }, { 0x1193E, 0x1193E },
+    { 0x11943, 0x11943 }, { 0x119D4, 0x119DB }, { 0x119E0, 0x119E0 },
+    { 0x11A01, 0x11A0A }, { 0x11A33, 0x11A38 }, { 0x11A3B, 0x11A3E },
+    { 0x11A47, 0x11A47 }, { 0x11A51, 0x11A56 }, { 0x11A59, 0x11A5B },
+    { 0x11A8A, 0x11A96 }, { 0x11A98, 0x11A99 }, { 0x11C30, 0x11C3D },
+    { 0x11C3F, 0x11C3F }, { 0x11C92, 0x11CA7 }, { 0x11CAA, 0x11CB0 },
+    { 0x11CB2, 0x11CB3 }, { 0x11CB5, 0x11CB6 }, { 0x11D31, 0x11D45 },
+    { 0x11D47, 0x11D47 }, { 0x11D90, 0x11D91 }, { 0x11D95, 0x11D95 },
+    { 0x11D97, 0x11D97 }, { 0x11EF3, 0x11EF4 }, { 0x13430, 0x13438 },
+    { 0x16AF0, 0x16AF4 }, { 0x16B30, 0x16B36 }, { 0x16F4F, 0x16F4F },
+    { 0x16F8F, 0x16F92 }, { 0x16FE4, 0x16FE4 }, { 0x1BC9D, 0x1BC9E },
+    { 0x1BCA0, 0x1BCA3 }, { 0x1CF00, 0x1CF46 }, { 0x1D167, 0x1D169 },
+    { 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD },
+    { 0x1D242, 0x1D244 }, { 0x1DA00, 0x1DA36 }, { 0x1DA3B, 0x1DA6C },
+    { 0x1DA75, 0x1DA75 }, { 0x1DA84, 0x1DA84 }, { 0x1DA9B, 0x1DAAF },
+    { 0x1E000, 0x1E02A }, { 0x1E130, 0x1E136 }, { 0x1E2AE, 0x1E2AE },
+    { 0x1E2EC, 0x1E2EF }, { 0x1E8D0, 0x1E8D6 }, { 0x1E944, 0x1E94A },
+    { 0xE0001, 0xE007F }, { 0xE0100, 0xE01EF }
+};
+
+static const struct interval double_width[] = {
+    { 0x01100, 0x0115F }, { 0x0231A, 0x0231B }, { 0x02329, 0x0232A },
+    { 0x023E9, 0x023EC }, { 0x023F0, 0x023F0 }, { 0x023F3, 0x023F3 },
+    { 0x025FD, 0x025FE }, { 0x02614, 0x02615 }, { 0x02648, 0x02653 },
+    { 0x0267F, 0x0267F }, { 0x02693, 0x02693 }, { 0x026A1, 0x026A1 },
+    { 0x026AA, 0x026AB }, { 0x026BD, 0x026BE }, { 0x026C4, 0x026C5 },
+    { 0x026CE, 0x026CE }, { 0x026D4, 0x026D4 }, { 0x026EA, 0x026EA },
+    { 0x026F2, 0x026F3 }, { 0x026F5, 0x026F5 }, { 0x026FA, 0x026FA },
+    { 0x026FD, 0x026FD }, { 0x02705, 0x02705 }, { 0x0270A, 0x0270B },
+    { 0x02728, 0x02728 }, { 0x0274C, 0x0274C }, { 0x0274E, 0x0274E },
+    { 0x02753, 0x02755 }, { 0x02757, 0x02757 }, { 0x02795, 0x02797 },
+    { 0x027B0, 0x027B0 }, { 0x027BF, 0x027BF }, { 0x02B1B, 0x02B1C },
+    { 0x02B50, 0x02B50 }, { 0x02B55, 0x02B55 }, { 0x02E80, 0x03029 },
+    { 0x0302E, 0x0303E }, { 0x03041, 0x03096 }, { 0x0309B, 0x03247 },
+    { 0x03250, 0x04DBF }, { 0x04E00, 0x0A4C6 }, { 0x0A960, 0x0A97C },
+    { 0x0AC00, 0x0D7A3 }, { 0x0F900, 0x0FAD9 }, { 0x0FE10, 0x0FE19 },
+    { 0x0FE30, 0x0FE6B }, { 0x0FF01, 0x0FF60 }, { 0x0FFE0, 0x0FFE6 },
+    { 0x16FE0, 0x16FE3 }, { 0x16FF0, 0x18CD5 }, { 0x18D00, 0x18D08 },
+    { 0x1AFF0, 0x1B122 }, { 0x1B150, 0x1B2FB }, { 0x1F004, 0x1F004 },
+    { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A },
+    { 0x1F200, 0x1F265 }, { 0x1F300, 0x1F320 }, { 0x1F32D, 0x1F335 },
+    { 0x1F337, 0x1F37C }, { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA },
+    { 0x1F3CF, 0x1F3D3 }, { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 },
+    { 0x1F3F8, 0x1F43E }, { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC },
+    { 0x1F4FF, 0x1F53D }, { 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 },
+    { 0x1F57A, 0x1F57A }, { 0x1F595, 0x1F596 }, { 0x1F5A4, 0x1F5A4 },
+    { 0x1F5FB, 0x1F64F }, { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC },
+    { 0x1F6D0, 0x1F6D2 }, { 0x1F6D5, 0x1F6DF }, { 0x1F6EB, 0x1F6EC },
+    { 0x1F6F4, 0x1F6FC }, { 0x1F7E0, 0x1F7F0 }, { 0x1F90C, 0x1F93A },
+    { 0x1F93C, 0x1F945 }, { 0x1F947, 0x1F9FF }, { 0x1FA70, 0x1FAF6 },
+    { 0x20000, 0x3FFFD }
+};
+
+static bool
+in_table( uint32_t c, const struct interval *table, size_t n ){
+    size_t lo = 0, hi = n, mid;
+    if( c < table[0].first || c > table[n-1].last ){
+        return false;
+    }
+    while( lo < hi ){
+        mid = lo + ( hi - lo ) / 2;
+        if( c > table[mid].last ){
+            lo = mid + 1;
+        }else if( c < table[mid].first ){
+            hi = mid;
+        }else{
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t
+code_point_width( uint32_t c ){
+    if( c < 0x300 ){
+        return 1;
+    }
+    if( in_table( c, zero_width, sizeof( zero_width ) / sizeof( zero_width[0] ) ) ){
+        return 0;
+    }
+    if( in_table( c, double_width, sizeof( double_width ) / sizeof( double_width[0] ) ) ){
+        return 2;
+    }
+    return 1;
+}
+
+static size_t
+ascii_prefix( const char *s, size_t n ){
+    // The number of bytes before the first one with its high bit set.
+    size_t i = 0;
+    uint64_t word;
+#if defined( __SSE2__ )
+    unsigned mask;
+    for( ; i + 16 <= n; i += 16 ){
+        mask = _mm_movemask_epi8( _mm_loadu_si128( (const __m128i *)( s + i ) ) );
+        if( 0 != mask ){
+            return i + __builtin_ctz( mask );
+        }
+    }
+#endif
+    for( ; i + 8 <= n; i += 8 ){
+        memcpy( &word, s + i, 8 );
+        if( 0 != ( word & 0x8080808080808080ULL ) ){
+            break;
+        }
+    }
+    while( i < n && 0 == ( s[i] & 0x80 ) ){
+        i++;
+    }
+    return i;
+}
+
+static size_t
+decode_utf8( const unsigned char *s, size_t n, uint32_t *c ){
+    // Reads one code point and returns its length in bytes.  A byte
+    // that doesn't start a valid sequence is taken on its own, as a
+    // terminal would show it as one replacement character.
+    size_t length, i;
+    uint32_t min;
+    if( s[0] < 0x80 ){
+        *c = s[0];
+        return 1;
+    }else if( 0xC0 == ( s[0] & 0xE0 ) ){
+        length = 2, min = 0x80, *c = s[0] & 0x1F;
+    }else if( 0xE0 == ( s[0] & 0xF0 ) ){
+        length = 3, min = 0x800, *c = s[0] & 0x0F;
+    }else if( 0xF0 == ( s[0] & 0xF8 ) ){
+        length = 4, min = 0x10000, *c = s[0] & 0x07;
+    }else{
+        *c = 0xFFFD;
+        return 1;
+    }
+    if( length > n ){
+        *c = 0xFFFD;
+        return 1;
+    }
+    for( i = 1; i < length; i++ ){
+        if( 0x80 != ( s[i] & 0xC0 ) ){
+            *c = 0xFFFD;
+            return 1;
+        }
+        *c = ( *c << 6 ) | ( s[i] & 0x3F );
+    }
+    if( *c < min || *c > 0x10FFFF || ( *c >= 0xD800 && *c <= 0xDFFF ) ){
+        *c = 0xFFFD;
+        return 1;
+    }
+    return length;
+}
+
+static size_t
+display_width( const char *s, size_t n ){
+    size_t i = ascii_prefix( s, n ), width = i;
+    uint32_t c;
+    while( i < n ){
+        i += decode_utf8( (const unsigned char *)s + i, n - i, &c );
+        width += code_point_width( c );
+    }
+    return width;
+}
+
+static void
+cut_padding( struct cell *cell, size_t length ){
+    // Keeps pad right as text is cut to length bytes from the end.
+    size_t value = cell->length - cell->pad;
+    if( PAD_RIGHT == cell->piece->padding ){
+        cell->pad = length > value ? length - value : 0;
+    }else if( cell->pad > length ){
+        cell->pad = length;
+    }
+}
+
+static void
+truncate_cell( struct cell *cell, size_t width ){
+    // Cuts text to at most width columns without splitting a
+    // character, keeping any zero-width characters that follow the
+    // last one kept.
+    size_t i = ascii_prefix( cell->text, cell->length ), used, w;
+    uint32_t c;
+    if( i >= width ){
+        cut_padding( cell, width );
+        cell->length = cell->width = width;
+        return;
+    }
+    used = i;
+    while( i < cell->length ){
+        size_t length = decode_utf8( (const unsigned char *)cell->text + i, cell->length - i, &c );
+        w = code_point_width( c );
+        if( used + w > width ){
+            break;
+        }
+        used += w;
+        i += length;
+    }
+    cut_padding( cell, i );
+    cell->length = i;
+    cell->width = used;
+}
+
+static size_t
+encode_utf8( char *p, uint32_t c ){
+    if( c > 0x10FFFF || ( c >= 0xD800 && c <= 0xDFFF ) ){
+        c = 0xFFFD;
+    }
+    if( c < 0x80 ){
+        p[0] = c;
+        return 1;
+    }else if( c < 0x800 ){
+        p[0] = 0xC0 | ( c >> 6 );
+        p[1] = 0x80 | ( c & 0x3F );
+        return 2;
+    }else if( c < 0x10000 ){
+        p[0] = 0xE0 | ( c >> 12 );
+        p[1] = 0x80 | ( ( c >> 6 ) & 0x3F );
+        p[2] = 0x80 | ( c & 0x3F );
+        return 3;
+    }
+    p[0] = 0xF0 | ( c >> 18 );
+    p[1] = 0x80 | ( ( c >> 12 ) & 0x3F );
+    p[2] = 0x80 | ( ( c >> 6 ) & 0x3F );
+    p[3] = 0x80 | ( c & 0x3F );
+    return 4;
+}
+
+static int
+format_wide( struct arena *arena, const char *original, type_t type, value *val, char **text ){
+    // %ls or %lc as UTF-8:  the value is encoded, then formatted with
+    // the same flags, width and precision as a plain %s.
+    char *spec, *utf8, *p;
+    const wchar_t *ws;
+    wchar_t wc[2] = { 0, 0 };
+    size_t n, i;
+    int rc;
+
+    if( C_WINT_T == type ){
+        wc[0] = val->c_wint_t;
+        ws = wc;
+    }else{
+        ws = val->c_wchar_tx;
+    }
+    n = wcslen( ws );
+    p = utf8 = arena_alloc( arena, 4 * n + 1 );
+    for( i = 0; i < n; i++ ){
+        p += encode_utf8( p, ws[i] );
+    }
+    *p = '\0';
+
+    // "%-10ls" becomes "%-10s", "%lc" becomes "%s".
+    n = strlen( original );
+    spec = arena_alloc( arena, n );
+    memcpy( spec, original, n - 2 );
+    spec[ n - 2 ] = 's';
+    spec[ n - 1 ] = '\0';
+    rc = snprintf( NULL, 0, spec, utf8 );
+    assert( rc >= 0 );
+    *text = arena_alloc( arena, rc + 1 );
+    snprintf( *text, rc + 1, spec, utf8 );
+    return rc;
+}
+
+static void
+render_text( struct arena *arena, struct cell *a ){
+    // Formats the value exactly once and keeps the text in the arena.
+    // Nearly everything fits in the stack buffer; anything longer is
+    // formatted straight into an arena allocation of the right size.
+    // Strings are copied, so the caller's may go away as soon as the
+    // row is appended; a plain %s needs no formatting at all.  A %c, %s
+    // or %p with a field width is formatted without it and the spaces
+    // added here, so the cell knows how many there are.
+    char buf[512], *text = buf, *padded;
+    const struct piece *piece = a->piece;
+    const char *spec = NULL != piece->unpadded_specification ? piece->unpadded_specification
+                                                              : piece->original_specification;
+    bool is_string = C_CHARX == piece->type || C_WCHAR_TX == piece->type;
+    size_t length, pad = 0;
+    int rc = -1;
+    if( C_CHARX == piece->type && NULL != a->val.c_charx
+            && '\0' == piece->flags[0] && '\0' == piece->field_width[0] && '\0' == piece->precision[0] ){
+        length = strlen( a->val.c_charx );
+        assert( length <= UINT32_MAX );
+        intern( arena, a->val.c_charx, length, &(a->text) );
+        a->val.c_charx = NULL;
+        a->length = length;
+        a->width = display_width( a->text, length );
+        a->pad = 0;
+        return;
+    }
+    if( '\0' != piece->style ){
+        rc = format_float( buf, sizeof( buf ), piece, &(a->val) );
+    }
+    if( rc < 0 ){
+        rc = format_value( buf, sizeof( buf ), spec, piece->type, &(a->val) );
+    }
+    if( rc < 0 && ( C_WCHAR_TX == piece->type || C_WINT_T == piece->type ) ){
+        // The locale can't encode it (e.g., it's "C").  fprintf()
+        // would print nothing; write it as UTF-8 instead.
+        rc = format_wide( arena, spec, piece->type, &(a->val), &text );
+    }else if( rc < 0 ){
+        // Any other encoding error.  fprintf() wouldn't print anything
+        // either.
+        rc = 0;
+    }else if( (size_t)rc >= sizeof( buf ) ){
+        text = arena_alloc( arena, rc+1 );
+        format_value( text, rc+1, spec, piece->type, &(a->val) );
+    }
+
+    if( NULL != piece->unpadded_specification && (size_t)rc < piece->minimum_width ){
+        pad = piece->minimum_width - rc;
+    }
+    length = rc + pad;
+    if( pad > 0 ){
+        padded = text == buf && length < sizeof( buf ) ? buf : arena_alloc( arena, length+1 );
+        if( PAD_RIGHT == piece->padding ){
+            memmove( padded, text, rc );
+            memset( padded + rc, ' ', pad );
+        }else{
+            memmove( padded + pad, text, rc );
+            memset( padded, ' ', pad );
+        }
+        text = padded;
+    }
+    if( text == buf && is_string ){
+        intern( arena, buf, length, &(a->text) );
+    }else if( text == buf ){
+        archive( arena, buf, length, &(a->text) );
+    }else{
+        a->text = text;
+    }
+    if( is_string ){
+        a->val.c_charx = NULL;
+        a->val.c_wchar_tx = NULL;
+    }
+    assert( length <= UINT32_MAX );
+    a->length = length;
+    a->width = display_width( a->text, length );
+    a->pad = pad;
+}
+
+static void
+render( struct arena *arena, struct cell *a ){
+    // Integers only need their width until they are printed.
+    struct integer n;
+    size_t length;
+    if( 0 == a->piece->base ){
+        render_text( arena, a );
+        return;
+    }
+    a->text = NULL;
+    length = measure_integer( a->piece, &(a->val), &n );
+    if( length < a->piece->minimum_width ){
+        length = a->piece->minimum_width;
+    }
+    assert( length <= UINT32_MAX );
+    a->length = a->width = length;
+    a->pad = 0;
+}
+
+type_t
+decode_type( const struct piece *piece ){
+    // Maps the length modifier and conversion specifier onto the type
+    // va_arg() needs.  This runs once per format, not once per value.
+    // FIXME Not (yet) supporting 'n' as a conversion specifier.
+    // Reproduces the big table at 
+    // https://en.cppreference.com/w/c/io/fprintf
+/*
+    length      conversion
+    modifier    specifier       type
+    --------------------------------
+    (none)      c               int
+    l           c               wint_t
+    (none)      s               char*
+    l           s               wchar_t*
+    hh          d/i             signed char [int]
+    h           d/i             short [int]
+    (none)      d/i             int
+    l           d/i             long
+    ll          d/i             long long
+    j           d/i             intmax_t
+    z           d/i             signed size_t [ssize_t]
+    t           d/i             ptrdiff_t
+    hh          o/x/X/u         unsigned char [int]
+    h           o/x/X/u         unsigned short [int]
+    (none)      o/x/X/u         unsigned int
+    l           o/x/X/u         unsigned long
+    ll          o/x/X/u         unsigned long long
+    j           o/x/X/u         uintmax_t
+    z           o/x/X/u         size_t
+    t           o/x/X/u         unsigned ptrdiff_t [?]
+    (none)/l    f/F/e/E/a/A/g/G double
+    L           f/F/e/E/a/A/g/G long double
+    (none)      p               void*
+*/
+    if( is(piece->conversion_specifier, "c") ){
+        if( is( piece->length_modifier, "" ) ){
+            return C_INT;
+        }else if( is( piece->length_modifier, "l" ) ){
+            return C_WINT_T;
+        }else{
+            assert(0);
+        }
+    }else if( is(piece->conversion_specifier, "s") ){
+        if( is( piece->length_modifier, "" ) ){
+            return C_CHARX;
+        }else if( is( piece->length_modifier, "l" ) ){
+            return C_WCHAR_TX;
+        }else{
+            assert(0);
+        }
+    }else if( is(piece->conversion_specifier, "d") 
+          ||  is(piece->conversion_specifier, "i") ){
+        if( is( piece->length_modifier, "hh" ) 
+        ||  is( piece->length_modifier, "h" ) 
+        ||  is( piece->length_modifier, "" ) ){
+            return C_INT;
+        }else if( is( piece->length_modifier, "l" ) ){
+            return C_LONG;
+        }else if( is( piece->length_modifier, "ll" ) ){
+            return C_LONG_LONG;
+        }else if( is( piece->length_modifier, "j" ) ){
+            return C_INTMAX_T;
+        }else if( is( piece->length_modifier, "z" ) ){
+            return C_SSIZE_T;
+        }else if( is( piece->length_modifier, "t" ) ){
+            return C_PTRDIFF_T;
+        }else{
+            assert(0);
+        }
+    }else if( is(piece->conversion_specifier, "o") 
+          ||  is(piece->conversion_specifier, "x") 
+          ||  is(piece->conversion_specifier, "X") 
+          ||  is(piece->conversion_specifier, "u") ){
+        if( is( piece->length_modifier, "hh" ) 
+        ||  is( piece->length_modifier, "h" ) ){
+            return C_INT;
+        }else if( is( piece->length_modifier, "" ) ){
+            return C_UNSIGNED_INT;
+        }else if( is( piece->length_modifier, "l" ) ){
+            return C_UNSIGNED_LONG;
+        }else if( is( piece->length_modifier, "ll" ) ){
+            return C_UNSIGNED_LONG_LONG;
+        }else if( is( piece->length_modifier, "j" ) ){
+            return C_UINTMAX_T;
+        }else if( is( piece->length_modifier, "z" ) ){
+            return C_SIZE_T;
+        }else if( is( piece->length_modifier, "t" ) ){
+            return C_PTRDIFF_T;
+        }else{
+            assert(0);
+        }
+    }else if( is(piece->conversion_specifier, "f") 
+          ||  is(piece->conversion_specifier, "F") 
+          ||  is(piece->conversion_specifier, "e") 
+          ||  is(piece->conversion_specifier, "E") 
+          ||  is(piece->conversion_specifier, "a") 
+          ||  is(piece->conversion_specifier, "A") 
+          ||  is(piece->conversion_specifier, "g") 
+          ||  is(piece->conversion_specifier, "G") ){
+        if( is( piece->length_modifier, "l" )
+        ||  is( piece->length_modifier, "" ) ){
+            return C_DOUBLE;
+        }else if( is( piece->length_modifier, "L" ) ){
+            return C_LONG_DOUBLE;
+        }else{
+            assert(0);
+        }
+    }else if( is(piece->conversion_specifier, "p") ){
+        if( is( piece->length_modifier, "" ) ){
+            return C_VOIDX;
+        }else{
+            assert(0);
+        }
+    }else{
+        assert(0);
+    }
+    return C_INT;   // not reached
+}
+
+static void
+store_argument( struct cell *a, const cprintf_arg_t *arg ){
+    // A CPRINTF_ROW() argument already carries its type, so it only
+    // has to be checked against the conversion and converted to the
+    // type the conversion expects.
+    bool integer = CPRINTF_ARG_SIGNED == arg->type || CPRINTF_ARG_UNSIGNED == arg->type;
+    bool floating = CPRINTF_ARG_DOUBLE == arg->type || CPRINTF_ARG_LONG_DOUBLE == arg->type;
+    intmax_t i = CPRINTF_ARG_SIGNED == arg->type ? arg->value.i : (intmax_t)arg->value.u;
+    uintmax_t u = CPRINTF_ARG_SIGNED == arg->type ? (uintmax_t)arg->value.i : arg->value.u;
+
+    switch( a->piece->type ){
+        case C_INT:                 assert( integer );  a->val.c_int                = i;    break;
+        case C_WINT_T:              assert( integer );  a->val.c_wint_t             = u;    break;
+        case C_LONG:                assert( integer );  a->val.c_long               = i;    break;
+        case C_LONG_LONG:           assert( integer );  a->val.c_long_long          = i;    break;
+        case C_INTMAX_T:            assert( integer );  a->val.c_intmax_t           = i;    break;
+        case C_SSIZE_T:             assert( integer );  a->val.c_ssize_t            = i;    break;
+        case C_PTRDIFF_T:           assert( integer );  a->val.c_ptrdiff_t          = i;    break;
+        case C_UNSIGNED_INT:        assert( integer );  a->val.c_unsigned_int       = u;    break;
+        case C_UNSIGNED_LONG:       assert( integer );  a->val.c_unsigned_long      = u;    break;
+        case C_UNSIGNED_LONG_LONG:  assert( integer );  a->val.c_unsigned_long_long = u;    break;
+        case C_UINTMAX_T:           assert( integer );  a->val.c_uintmax_t          = u;    break;
+        case C_SIZE_T:              assert( integer );  a->val.c_size_t             = u;    break;
+        case C_DOUBLE:
+            assert( floating );
+            a->val.c_double = CPRINTF_ARG_DOUBLE == arg->type ? arg->value.d : (double)arg->ld;
+            break;
+        case C_LONG_DOUBLE:
+            assert( floating );
+            a->val.c_long_double = CPRINTF_ARG_DOUBLE == arg->type ? arg->value.d : arg->ld;
+            break;
+        case C_CHARX:
+            // (void *)0 is a fine %s, but a wide string is not.
+            assert( CPRINTF_ARG_STRING == arg->type || CPRINTF_ARG_POINTER == arg->type );
+            a->val.c_charx = (char *)arg->value.p;
+            break;
+        case C_WCHAR_TX:
+            assert( CPRINTF_ARG_WIDE_STRING == arg->type || CPRINTF_ARG_POINTER == arg->type );
+            a->val.c_wchar_tx = (wchar_t *)arg->value.p;
+            break;
+        case C_VOIDX:
+            assert( !integer && !floating );
+            a->val.c_voidx = (void *)arg->value.p;
+            break;
+        default:
+            assert(0);
+            break;
+    }
+}
+
+// The smallest and largest integers in a column, as load_column()
+// found them while reading it.  Both start at zero, which is never
+// wider than any other value.
+struct extremes{
+    bool found;
+    intmax_t lowest;
+    uintmax_t highest;
+};
+
+#define LOAD( T, member )                                                   \
+    for( r = 0; r < n; r++ ){                                               \
+        cells[r].val.member = *(T const *)( p + r * stride );               \
+    }                                                                       \
+    break
+
+#define LOAD_INTEGER( T, member )                                           \
+    {                                                                       \
+        T v_, lowest_ = 0, highest_ = 0;                                    \
+        for( r = 0; r < n; r++ ){                                           \
+            v_ = *(T const *)( p + r * stride );                            \
+            cells[r].val.member = v_;                                       \
+            cells[r].text = NULL;                                           \
+            cells[r].length = cells[r].width = cells[r].pad = 0;            \
+            lowest_ = v_ < lowest_ ? v_ : lowest_;                          \
+            highest_ = v_ > highest_ ? v_ : highest_;                       \
+        }                                                                   \
+        e->found = true;                                                    \
+        e->lowest = lowest_;                                                \
+        e->highest = highest_;                                              \
+    }                                                                       \
+    break
+
+static void
+load_column( struct cell *cells, size_t n, const void *base, size_t offset, size_t stride, struct extremes *e ){
+    // Reads n elements of a column into cells, which are all for the
+    // same piece.  Columns hold the type a conversion takes before
+    // promotion:  char for %c, signed char for %hhd, unsigned short
+    // for %hu, and so on.  Integers are left unrendered, with their
+    // extremes noted in e.
+    const struct piece *piece = cells[0].piece;
+    const char *p = (const char *)base + offset;
+    bool is_signed = is( piece->conversion_specifier, "d" ) || is( piece->conversion_specifier, "i" );
+    size_t r;
+    e->found = false;
+    switch( piece->type ){
+        case C_INT:
+            if( is( piece->conversion_specifier, "c" ) ){
+                LOAD( char, c_int );
+            }else if( is( piece->length_modifier, "hh" ) && is_signed ){
+                LOAD_INTEGER( signed char, c_int );
+            }else if( is( piece->length_modifier, "hh" ) ){
+                LOAD_INTEGER( unsigned char, c_int );
+            }else if( is( piece->length_modifier, "h" ) && is_signed ){
+                LOAD_INTEGER( short, c_int );
+            }else if( is( piece->length_modifier, "h" ) ){
+                LOAD_INTEGER( unsigned short, c_int );
+            }else{
+                LOAD_INTEGER( int, c_int );
+            }
+        case C_WINT_T:              LOAD( wint_t, c_wint_t );
+        case C_CHARX:               LOAD( char *, c_charx );
+        case C_WCHAR_TX:            LOAD( wchar_t *, c_wchar_tx );
+        case C_LONG:                LOAD_INTEGER( long, c_long );
+        case C_LONG_LONG:           LOAD_INTEGER( long long, c_long_long );
+        case C_INTMAX_T:            LOAD_INTEGER( intmax_t, c_intmax_t );
+        case C_SSIZE_T:             LOAD_INTEGER( ssize_t, c_ssize_t );
+        case C_PTRDIFF_T:           LOAD( ptrdiff_t, c_ptrdiff_t );    // may print as unsigned
+        case C_UNSIGNED_INT:        LOAD_INTEGER( unsigned int, c_unsigned_int );
+        case C_UNSIGNED_LONG:       LOAD_INTEGER( unsigned long, c_unsigned_long );
+        case C_UNSIGNED_LONG_LONG:  LOAD_INTEGER( unsigned long long, c_unsigned_long_long );
+        case C_UINTMAX_T:           LOAD_INTEGER( uintmax_t, c_uintmax_t );
+        case C_SIZE_T:              LOAD_INTEGER( size_t, c_size_t );
+        case C_DOUBLE:              LOAD( double, c_double );
+        case C_LONG_DOUBLE:         LOAD( long double, c_long_double );
+        case C_VOIDX:               LOAD( void *, c_voidx );
+        default:
+                                    assert(0);
+                                    break;
+    }
+}
+
+#undef LOAD
+#undef LOAD_INTEGER
+
+static void
+calc_actual_width( struct arena *arena, struct cell *a, struct arguments *args ){
+    // Takes the next argument according to the type decoded at compile
+    // time and renders it.
+    if( NULL != args->array ){
+        assert( args->next < args->count );     // too few arguments
+        store_argument( a, &(args->array[ args->next++ ]) );
+        render( arena, a );
+        return;
+    }
+    if( NULL != args->columns ){
+        const cprintf_column_t *column = &(args->columns[ args->next++ ]);
+        struct extremes e;
+        assert( args->next <= args->count );    // too few columns
+        load_column( a, 1, column->base, column->stride * args->row, 0, &e );
+        render( arena, a );
+        return;
+    }
+    switch( a->piece->type ){
+        case C_INT:                 a->val.c_int                = va_arg( *(args->list), int );                 break;
+        case C_WINT_T:              a->val.c_wint_t             = va_arg( *(args->list), wint_t );              break;
+        case C_CHARX:               a->val.c_charx              = va_arg( *(args->list), char* );               break;
+        case C_WCHAR_TX:            a->val.c_wchar_tx           = va_arg( *(args->list), wchar_t* );            break;
+        case C_LONG:                a->val.c_long               = va_arg( *(args->list), long );                break;
+        case C_LONG_LONG:           a->val.c_long_long          = va_arg( *(args->list), long long );           break;
+        case C_INTMAX_T:            a->val.c_intmax_t           = va_arg( *(args->list), intmax_t );            break;
+        case C_SSIZE_T:             a->val.c_ssize_t            = va_arg( *(args->list), ssize_t );             break;
+        case C_PTRDIFF_T:           a->val.c_ptrdiff_t          = va_arg( *(args->list), ptrdiff_t );           break;
+        case C_UNSIGNED_INT:        a->val.c_unsigned_int       = va_arg( *(args->list), unsigned int );        break;
+        case C_UNSIGNED_LONG:       a->val.c_unsigned_long      = va_arg( *(args->list), unsigned long );       break;
+        case C_UNSIGNED_LONG_LONG:  a->val.c_unsigned_long_long = va_arg( *(args->list), unsigned long long );  break;
+        case C_UINTMAX_T:           a->val.c_uintmax_t          = va_arg( *(args->list), uintmax_t );           break;
+        case C_SIZE_T:              a->val.c_size_t             = va_arg( *(args->list), size_t );              break;
+        case C_DOUBLE:              a->val.c_double             = va_arg( *(args->list), double );              break;
+        case C_LONG_DOUBLE:         a->val.c_long_double        = va_arg( *(args->list), long double );         break;
+        case C_VOIDX:               a->val.c_voidx              = va_arg( *(args->list), void* );               break;
+        default:
+                                    assert(0);
+                                    break;
+    }
+    render( arena, a );
+}
+
+static uint64_t
+now_ns( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+phase( struct ctable *t, cprintf_phase_t p, bool begin ){
+    // Marks the start or end of a flush phase for the user's hook and
+    // the phase timers.  The clock is read inside the hook call so the
+    // hook's own time isn't charged to the phase.
+    if( begin && NULL != t->hook ){
+        t->hook( t->hook_context, p, 1 );
+    }
+    if( t->timing ){
+        if( begin ){
+            t->stats.phase_start[p] = now_ns();
+        }else{
+            t->stats.phase_ns[p] += now_ns() - t->stats.phase_start[p];
+        }
+    }
+    if( !begin && NULL != t->hook ){
+        t->hook( t->hook_context, p, 0 );
+    }
+}
+
+static void
+deliver( struct ctable *t ){
+    // Hands every filled chunk to the sink and empties them.  Once a
+    // write fails, its errno is kept for cterror() and the table's
+    // output is dropped until then.
+    struct sink *sink = &t->sink;
+    struct output *out = &t->out;
+    size_t i, n = out->current + 1, done;
+    ssize_t rc;
+    struct iovec *iov = out->chunks;
+
+    if( 0 == out->chunks[0].iov_len ){
+        return;     // nothing to say
+    }
+    phase( t, CPRINTF_PHASE_WRITE, true );
+    if( 0 != t->error ){
+        n = 0;
+    }
+    switch( sink->kind ){
+        case SINK_FD:
+            // One system call for up to a megabyte of table.
+            while( n > 0 ){
+                rc = writev( sink->fd, iov, n );   // OUTPUT_CHUNKS <= _XOPEN_IOV_MAX
+                if( rc < 0 && EINTR == errno ){
+                    continue;
+                }
+                if( rc <= 0 ){
+                    t->error = rc < 0 ? errno : EIO;
+                    break;
+                }
+                t->stats.bytes_written += rc;
+                while( n > 0 && (size_t)rc >= iov->iov_len ){
+                    rc -= iov->iov_len;
+                    iov->iov_len = 0;
+                    iov++;
+                    n--;
+                }
+                if( n > 0 ){
+                    // Partial write; slide the remainder down.
+                    memmove( iov->iov_base, (char *)iov->iov_base + rc, iov->iov_len - rc );
+                    iov->iov_len -= rc;
+                }
+            }
+            break;
+        default:
+            for( i = 0; i < n; i++ ){
+                if( 0 == out->chunks[i].iov_len ){
+                    continue;
+                }
+                switch( sink->kind ){
+                    case SINK_FILE:
+                        errno = 0;
+                        done = fwrite( out->chunks[i].iov_base, 1, out->chunks[i].iov_len, sink->stream );
+                        if( done < out->chunks[i].iov_len ){
+                            t->error = 0 != errno ? errno : EIO;
+                            n = 0;
+                        }
+                        t->stats.bytes_written += done;
+                        break;
+                    case SINK_BUFFER:
+                        // Like snprintf(), keep room for the '\0' and
+                        // count what didn't fit.
+                        if( sink->size > 0 && sink->length < sink->size - 1 ){
+                            done = sink->size - 1 - sink->length;
+                            if( done > out->chunks[i].iov_len ){
+                                done = out->chunks[i].iov_len;
+                            }
+                            memcpy( sink->buffer + sink->length, out->chunks[i].iov_base, done );
+                            sink->buffer[ sink->length + done ] = '\0';
+                        }
+                        sink->length += out->chunks[i].iov_len;
+                        break;
+                    case SINK_STRING:
+                        if( sink->length + out->chunks[i].iov_len + 1 > sink->size ){
+                            sink->size = ( sink->length + out->chunks[i].iov_len + 1 ) * 2;
+                            sink->buffer = realloc( sink->buffer, sink->size );
+                            assert( sink->buffer );
+                            t->stats.allocations++;
+                        }
+                        memcpy( sink->buffer + sink->length, out->chunks[i].iov_base, out->chunks[i].iov_len );
+                        sink->length += out->chunks[i].iov_len;
+                        sink->buffer[ sink->length ] = '\0';
+                        break;
+                    case SINK_CALLBACK:
+                        sink->write( sink->context, out->chunks[i].iov_base, out->chunks[i].iov_len );
+                        break;
+                    default:
+                        assert(0);
+                        break;
+                }
+                if( SINK_FILE != sink->kind ){
+                    t->stats.bytes_written += out->chunks[i].iov_len;
+                }
+                out->chunks[i].iov_len = 0;
+            }
+            break;
+    }
+    for( i = 0; i <= out->current; i++ ){
+        out->chunks[i].iov_len = 0;     // anything not written is dropped
+    }
+    out->current = 0;
+    phase( t, CPRINTF_PHASE_WRITE, false );
+}
+
+static char *
+output_reserve( struct ctable *t, size_t *n ){
+    // Returns space for up to *n bytes in the current chunk, trimming
+    // *n to what's available.  Full chunks move on to the next one,
+    // and once every chunk is full they go to the sink.
+    struct output *out = &t->out;
+    struct iovec *chunk = &(out->chunks[ out->current ]);
+    if( chunk->iov_len == OUTPUT_CHUNK_SIZE ){
+        if( out->current + 1 == OUTPUT_CHUNKS ){
+            deliver( t );
+        }else{
+            out->current++;
+        }
+        chunk = &(out->chunks[ out->current ]);
+    }
+    if( NULL == chunk->iov_base ){
+        // Chunks are kept for the life of the table.
+        chunk->iov_base = malloc( OUTPUT_CHUNK_SIZE );
+        assert( chunk->iov_base );
+        t->stats.allocations++;
+    }
+    if( *n > OUTPUT_CHUNK_SIZE - chunk->iov_len ){
+        *n = OUTPUT_CHUNK_SIZE - chunk->iov_len;
+    }
+    return (char *)chunk->iov_base + chunk->iov_len;
+}
+
+static void
+output_write( struct ctable *t, const char *p, size_t n ){
+    size_t chunk;
+    char *q;
+    while( n > 0 ){
+        chunk = n;
+        q = output_reserve( t, &chunk );
+        memcpy( q, p, chunk );
+        t->out.chunks[ t->out.current ].iov_len += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+static void
+output_fill( struct ctable *t, char fill, size_t n ){
+    size_t chunk;
+    char *q;
+    while( n > 0 ){
+        chunk = n;
+        q = output_reserve( t, &chunk );
+        memset( q, fill, chunk );
+        t->out.chunks[ t->out.current ].iov_len += chunk;
+        n -= chunk;
+    }
+}
+
+padding_t
+decode_padding( const struct piece *piece ){
+    // printf pads with zeros only for numeric conversions, and for
+    // integers only when no precision was given.  '-' overrides '0'.
+    char c = piece->conversion_specifier[0];
+
+    if( NULL != strchr( piece->flags, '-' ) ){
+        return PAD_RIGHT;
+    }
+    if( NULL == strchr( piece->flags, '0' ) ){
+        return PAD_LEFT;
+    }
+    if( NULL != strchr( "diouxX", c ) ){
+        return '\0' == piece->precision[0] ? PAD_ZERO : PAD_LEFT;
+    }
+    if( NULL != strchr( "fFeEgGaAp", c ) ){
+        return PAD_ZERO;
+    }
+    return PAD_LEFT;
+}
+
+void
+decode_integer( struct piece *piece ){
+    // Decides whether the integer kernels can stand in for printf()
+    // and, if so, decodes the specification for them.  The ' and I
+    // flags depend on the locale and are left to printf().
+    // is_signed and narrow are set for every integer conversion, as
+    // exports read the value even when printf() formats it.
+    char c = piece->conversion_specifier[0];
+
+    piece->base = 0;
+    if( NULL == strchr( "diouxX", c ) ){
+        return;
+    }
+    piece->is_signed = 'd' == c || 'i' == c;
+    piece->narrow = is( piece->length_modifier, "hh" ) ? (int)sizeof( char )
+                  : is( piece->length_modifier, "h" )  ? (int)sizeof( short )
+                  : 0;
+    if( strspn( piece->flags, "#0- +" ) != strlen( piece->flags ) ){
+        return;
+    }
+    piece->base = 'o' == c ? 8 : ( 'x' == c || 'X' == c ) ? 16 : 10;
+    piece->uppercase = 'X' == c;
+    piece->alternate = NULL != strchr( piece->flags, '#' );
+    piece->sign = NULL != strchr( piece->flags, '+' ) ? '+'
+                : NULL != strchr( piece->flags, ' ' ) ? ' '
+                : '\0';
+}
+
+void
+decode_float( struct piece *piece ){
+    // As decode_integer(), for the floating point kernel.  Building
+    // with -DCPRINTF_LIBC_FLOAT leaves all floating point to libc.
+    piece->style = '\0';
+#ifndef CPRINTF_LIBC_FLOAT
+    char c = piece->conversion_specifier[0];
+    if( NULL == strchr( "fFeEgGaA", c ) || strspn( piece->flags, "#0- +" ) != strlen( piece->flags ) ){
+        return;
+    }
+    piece->style = c | 0x20;    // lower case
+    piece->uppercase = c != piece->style;
+    piece->alternate = NULL != strchr( piece->flags, '#' );
+    piece->sign = NULL != strchr( piece->flags, '+' ) ? '+'
+                : NULL != strchr( piece->flags, ' ' ) ? ' '
+                : '\0';
+#endif
+}
+
+static size_t
+zero_pad_offset( struct cell *a ){
+    // The zeros go after any sign and any 0x prefix.  Returns how many
+    // bytes of text precede the zeros, or SIZE_MAX if this particular
+    // value (inf, nan, or a null pointer) is padded with spaces instead.
+    const char *t = a->text;
+    char c = a->piece->conversion_specifier[0];
+    size_t i = 0;
+
+    if( '-' == t[i] || '+' == t[i] || ' ' == t[i] ){
+        i++;
+    }
+    if( NULL != strchr( "fFeEgGaA", c ) && ( t[i] < '0' || t[i] > '9' ) ){
+        return SIZE_MAX;    // inf, nan
+    }
+    if( 'p' == c && '0' != t[i] ){
+        return SIZE_MAX;    // (nil)
+    }
+    if( '0' == t[i] && ( 'x' == t[i+1] || 'X' == t[i+1] ) ){
+        i += 2;
+    }
+    return i;
+}
+
+static void
+emit_integer( struct ctable *t, const struct cell *cell, size_t width ){
+    // Prints an integer cell, padding included, without formatting it
+    // first.
+    struct integer n;
+    size_t length = measure_integer( cell->piece, &(cell->val), &n );
+    size_t pad = width > length ? width - length : 0;
+    size_t room = n.digits;
+    char buf[24], *p;
+
+    if( PAD_LEFT == cell->piece->padding ){
+        output_fill( t, ' ', pad );
+    }
+    output_write( t, n.prefix, n.prefix_length );
+    if( PAD_ZERO == cell->piece->padding ){
+        output_fill( t, '0', pad );
+    }
+    output_fill( t, '0', n.zeros );
+    p = output_reserve( t, &room );
+    if( room == n.digits ){
+        write_digits( p + n.digits, n.magnitude, cell->piece, n.digits );
+        t->out.chunks[ t->out.current ].iov_len += n.digits;
+    }else{
+        // Straddles the end of a chunk.
+        write_digits( buf + n.digits, n.magnitude, cell->piece, n.digits );
+        output_write( t, buf, n.digits );
+    }
+    if( PAD_RIGHT == cell->piece->padding ){
+        output_fill( t, ' ', pad );
+    }
+}
+
+static void
+emit_cell( struct ctable *t, struct cell *cell, size_t width ){
+    size_t pad, offset;
+    if( !cell->piece->is_conversion_specification ){
+        output_write( t, cell->text, cell->length );
+        return;
+    }
+    if( NULL == cell->text ){
+        emit_integer( t, cell, width );
+        return;
+    }
+    pad = width > cell->width ? width - cell->width : 0;
+    if( 0 == pad ){
+        output_write( t, cell->text, cell->length );
+        return;
+    }
+    switch( cell->piece->padding ){
+        case PAD_RIGHT:
+            output_write( t, cell->text, cell->length );
+            output_fill( t, ' ', pad );
+            break;
+        case PAD_ZERO:
+            if( SIZE_MAX != ( offset = zero_pad_offset( cell ) ) ){
+                output_write( t, cell->text, offset );
+                output_fill( t, '0', pad );
+                output_write( t, cell->text + offset, cell->length - offset );
+                break;
+            }
+            // fall through
+        case PAD_LEFT:
+            output_fill( t, ' ', pad );
+            output_write( t, cell->text, cell->length );
+            break;
+    }
+}
+
+struct chunk{
+    struct ctable *t;
+    struct ctable *worker;
+    size_t first, last;         // rows
+    size_t *next;               // cell of each column in row first
+};
+
+static void *
+render_chunk( void *arg ){
+    struct chunk *k = arg;
+    struct ctable *t = k->t;
+    size_t r, c;
+    for( r = k->first; r < k->last; r++ ){
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            emit_cell( k->worker, &(t->columns[c].cells[ k->next[c]++ ]), t->columns[c].width );
+        }
+    }
+    deliver( k->worker );
+    return NULL;
+}
+
+static void
+skip_rows( const struct ctable *t, size_t first, size_t last, size_t *next ){
+    // Moves each column's cursor past rows first to last-1, a run of
+    // rows of the same length at a time.
+    size_t r = first, run, c;
+    uint32_t length;
+    while( r < last ){
+        length = t->row_lengths[r];
+        for( run = 1; r + run < last && t->row_lengths[ r + run ] == length; run++ ){
+            ;
+        }
+        for( c = 0; c < length; c++ ){
+            next[c] += run;
+        }
+        r += run;
+    }
+}
+
+static void
+print_in_parallel( struct ctable *t, size_t rows_per_chunk ){
+    struct parallel *p = &t->parallel;
+    struct chunk *chunks;
+    struct sink string = { SINK_STRING, NULL, -1, NULL, 0, 0, NULL, NULL };
+    size_t first = 0, k, n, c;
+    struct ctable *w;
+    int rc;
+
+    if( p->nworkers < p->nthreads ){
+        p->workers = realloc( p->workers, p->nthreads * sizeof( struct ctable * ) );
+        p->chunks = realloc( p->chunks, p->nthreads * sizeof( struct chunk ) );
+        p->threads = realloc( p->threads, p->nthreads * sizeof( pthread_t ) );
+        assert( p->workers && p->chunks && p->threads );
+        t->stats.allocations += 3;
+        for( ; p->nworkers < p->nthreads; p->nworkers++ ){
+            w = p->workers[ p->nworkers ] = create_table( &string );
+            w->dump_stats = w->timing = false;
+        }
+    }
+    chunks = p->chunks;
+    if( p->cursor_capacity < t->ncolumns || p->cursor_threads < p->nthreads ){
+        // ctthreads() may have raised the thread count since.
+        free( p->cursors );
+        p->cursors = malloc( p->nthreads * t->ncolumns * sizeof( size_t ) );
+        assert( p->cursors );
+        t->stats.allocations++;
+        p->cursor_capacity = t->ncolumns;
+        p->cursor_threads = p->nthreads;
+    }
+    for( c = 0; c < t->ncolumns; c++ ){
+        p->cursors[c] = 0;
+    }
+
+    while( first < t->nrows ){
+        // Hand out a wave of chunks, each starting where the one before
+        // it left every column.
+        for( n = 0; n < p->nthreads && first < t->nrows; n++ ){
+            chunks[n].t = t;
+            chunks[n].worker = p->workers[n];
+            chunks[n].first = first;
+            chunks[n].last = first + rows_per_chunk < t->nrows ? first + rows_per_chunk : t->nrows;
+            chunks[n].next = p->cursors + n * p->cursor_capacity;
+            if( n > 0 ){
+                memcpy( chunks[n].next, chunks[n-1].next, t->ncolumns * sizeof( size_t ) );
+                skip_rows( t, chunks[n-1].first, chunks[n-1].last, chunks[n].next );
+            }
+            first = chunks[n].last;
+        }
+        for( k = 1; k < n; k++ ){
+            rc = pthread_create( &(p->threads[k]), NULL, render_chunk, &chunks[k] );
+            assert( 0 == rc );
+            (void)rc;
+        }
+        render_chunk( &chunks[0] );
+        for( k = 1; k < n; k++ ){
+            pthread_join( p->threads[k], NULL );
+        }
+
+        for( k = 0; k < n; k++ ){
+            w = chunks[k].worker;
+            output_write( t, w->sink.buffer, w->sink.length );
+            w->sink.length = 0;
+        }
+        // The last chunk left off where the next wave starts.
+        if( n > 1 ){
+            memcpy( p->cursors, chunks[n-1].next, t->ncolumns * sizeof( size_t ) );
+        }
+    }
+}
+
+void
+print_something_already( struct ctable *t ){
+    // Column widths were settled as cells were captured, so this is
+    // the only pass cflush() makes over the table.
+    size_t r, c, rows_per_chunk;
+    for( c = 0; c < t->ncolumns; c++ ){
+        t->columns[c].next = 0;
+    }
+    if( t->parallel.nthreads > 1 && t->ncolumns > 0 ){
+        rows_per_chunk = PARALLEL_CHUNK_CELLS / t->ncolumns;
+        if( t->nrows > rows_per_chunk ){
+            print_in_parallel( t, rows_per_chunk );
+            return;
+        }
+    }
+    for( r = 0; r < t->nrows; r++ ){
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            emit_cell( t, &(t->columns[c].cells[ t->columns[c].next++ ]), t->columns[c].width );
+        }
+    }
+}
+
+#define SWAP( a, b ) do{ __typeof__( a ) swap_ = (a); (a) = (b); (b) = swap_; }while( 0 )
+
+static size_t
+frame_length( const struct ctable *f ){
+    // Bytes output so far:  every chunk before the current one is full.
+    return f->sink.length + f->out.current * OUTPUT_CHUNK_SIZE + f->out.chunks[ f->out.current ].iov_len;
+}
+
+static void
+move_cursor( struct ctable *t, size_t n, char direction ){
+    char buf[32];
+    if( n > 0 ){
+        output_write( t, buf, snprintf( buf, sizeof( buf ), "\x1b[%zu%c", n, direction ) );
+    }
+}
+
+static size_t
+line_cells( const struct frame *f, size_t *k, size_t end ){
+    // Moves *k past the cells that start before end (the line's '\n')
+    // or on it, and returns how many there were.
+    size_t first = *k;
+    while( *k < f->ncells && f->starts[ *k ] <= end ){
+        (*k)++;
+    }
+    return *k - first;
+}
+
+static void
+draw_changes( struct ctable *t, const struct frame *old, const struct frame *new ){
+    // The cursor is where the old frame left it.  Lines the two frames
+    // share are compared and, where they differ, either the changed
+    // cells or the whole line are written over the old ones.  Lines
+    // differ cell by cell only if their cells start at the same places,
+    // which is the case unless a column width changed; then every line
+    // is written again.  The rest of the new frame follows, and
+    // whatever was left of the old one is erased.
+    bool same, full = old->ncolumns != new->ncolumns
+             || 0 != memcmp( old->widths, new->widths, new->ncolumns * sizeof( size_t ) );
+    const char *o = old->text, *n = new->text, *p;
+    size_t up = 0, line = 0, cursor = 0, ol, nl, ok = 0, nk = 0, oa, na, cells, c, s, e;
+
+    for( p = o; NULL != ( p = memchr( p, '\n', old->text + old->length - p ) ); p++ ){
+        up++;
+    }
+    move_cursor( t, up, 'A' );
+    output_write( t, "\r", 1 );
+
+    for( ; line < up && n < new->text + new->length; line++ ){
+        p = memchr( o, '\n', old->text + old->length - o );
+        ol = p - o;
+        p = memchr( n, '\n', new->text + new->length - n );
+        nl = NULL == p ? (size_t)( new->text + new->length - n ) : (size_t)( p - n );
+        if( NULL == p ){
+            break;      // the new frame's last line; drawn below
+        }
+        // Cells only line up if both lines start with one and the
+        // rest follow at the same distances.
+        oa = ok;
+        na = nk;
+        cells = line_cells( old, &ok, o - old->text + ol );
+        same = cells == line_cells( new, &nk, n - new->text + nl )
+            && !full && ol == nl && cells > 0
+            && old->starts[ oa ] == (size_t)( o - old->text )
+            && new->starts[ na ] == (size_t)( n - new->text );
+        for( c = 1; same && c < cells; c++ ){
+            same = old->starts[ oa + c ] - old->starts[ oa ] == new->starts[ na + c ] - new->starts[ na ];
+        }
+        if( full || ol != nl || 0 != memcmp( o, n, nl ) ){
+            move_cursor( t, line - cursor, 'B' );
+            cursor = line;
+            if( same ){
+                for( c = 0; c < cells; c++ ){
+                    s = new->starts[ na + c ] - new->starts[ na ];
+                    e = c + 1 < cells ? new->starts[ na + c + 1 ] - new->starts[ na ] : nl;
+                    e = e > nl ? nl : e;
+                    if( s < e && 0 != memcmp( o + s, n + s, e - s ) ){
+                        move_cursor( t, display_width( n, s ) + 1, 'G' );
+                        output_write( t, n + s, e - s );
+                    }
+                }
+            }else{
+                output_write( t, "\r", 1 );
+                output_write( t, n, nl );
+                output_write( t, "\x1b[K", 3 );
+            }
+        }
+        o += ol + 1;
+        n += nl + 1;
+    }
+
+    // Everything from here on is written out in full.
+    move_cursor( t, line - cursor, 'B' );
+    output_write( t, "\r", 1 );
+    while( n < new->text + new->length ){
+        p = memchr( n, '\n', new->text + new->length - n );
+        nl = NULL == p ? (size_t)( new->text + new->length - n ) : (size_t)( p - n );
+        output_write( t, n, nl );
+        output_write( t, "\x1b[K", 3 );
+        if( NULL != p ){
+            output_write( t, "\n", 1 );
+        }
+        n += nl + 1;
+    }
+    output_write( t, "\x1b[J", 3 );
+}
+
+static void
+draw_live_frame( struct ctable *t ){
+    // Pads the table into the next frame and draws it over the last.
+    struct live *l = &t->live;
+    struct frame *new = &(l->frames[ l->current ]), *old = &(l->frames[ !l->current ]);
+    struct sink string = { SINK_STRING, NULL, -1, NULL, 0, 0, NULL, NULL };
+    struct ctable *f = l->frame;
+    size_t r, c, k = 0, ncells = 0;
+
+    if( NULL == f ){
+        f = l->frame = create_table( &string );
+        f->dump_stats = f->timing = false;
+    }
+    for( c = 0; c < t->ncolumns; c++ ){
+        ncells += t->columns[c].ncells;
+        t->columns[c].next = 0;
+    }
+    if( new->capacity < ncells + 1 || new->capacity < t->ncolumns ){
+        new->capacity = ncells + 1 > t->ncolumns ? ncells + 1 : t->ncolumns;
+        free( new->starts );
+        free( new->widths );
+        new->starts = malloc( new->capacity * sizeof( size_t ) );
+        new->widths = malloc( new->capacity * sizeof( size_t ) );
+        assert( new->starts && new->widths );
+        t->stats.allocations += 2;
+    }
+    for( r = 0; r < t->nrows; r++ ){
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            new->starts[ k++ ] = frame_length( f );
+            emit_cell( f, &(t->columns[c].cells[ t->columns[c].next++ ]), t->columns[c].width );
+        }
+    }
+    deliver( f );
+    new->starts[k] = f->sink.length;
+    new->ncells = k;
+    for( c = 0; c < t->ncolumns; c++ ){
+        new->widths[c] = t->columns[c].width;
+    }
+    new->ncolumns = t->ncolumns;
+
+    // The frame's text stays here, and the string it was written to
+    // takes over the storage of the frame before.
+    SWAP( new->text, f->sink.buffer );
+    SWAP( new->size, f->sink.size );
+    new->length = f->sink.length;
+    f->sink.length = 0;
+
+    if( old->drawn ){
+        draw_changes( t, old, new );
+    }else{
+        output_write( t, new->text, new->length );
+    }
+    old->drawn = false;
+    new->drawn = true;
+    l->current = !l->current;
+}
+
+static void
+apply_min_widths( struct ctable *t ){
+    // min_widths[k] applies to the column holding the kth conversion
+    // of the most recent row.
+    size_t c, k = 0;
+    struct cell *cell;
+    for( c = 0; c < t->row_lengths[ t->nrows-1 ] && k < t->streaming.nwidths; c++ ){
+        cell = &(t->columns[c].cells[ t->columns[c].ncells-1 ]);
+        if( cell->piece->is_conversion_specification ){
+            if( t->streaming.min_widths[k] > t->columns[c].width ){
+                t->columns[c].width = t->streaming.min_widths[k];
+            }
+            k++;
+        }
+    }
+}
+
+static size_t
+string_size( const char *p ){
+    return NULL == p ? 0 : strlen( p ) + 1;
+}
+
+static char *
+copy_string( char **to, const char *p ){
+    char *q = NULL;
+    if( NULL != p ){
+        q = *to;
+        memcpy( q, p, string_size( p ) );
+        *to += string_size( p );
+    }
+    return q;
+}
+
+static size_t
+pieces_size( const struct piece *pieces, size_t n ){
+    size_t i, bytes = n * sizeof( struct piece );
+    for( i = 0; i < n; i++ ){
+        bytes += string_size( pieces[i].original_specification )
+               + string_size( pieces[i].unpadded_specification )
+               + string_size( pieces[i].flags )
+               + string_size( pieces[i].field_width )
+               + string_size( pieces[i].precision )
+               + string_size( pieces[i].length_modifier )
+               + string_size( pieces[i].conversion_specifier )
+               + string_size( pieces[i].ordinary_text );
+    }
+    return bytes;
+}
+
+static struct piece *
+flatten_pieces( void *to, const struct piece *pieces, size_t n ){
+    // A deep copy of n pieces into the pieces_size() bytes at to, for
+    // the few pieces that must outlive their format.
+    struct piece *copy = to;
+    char *p = (char *)&(copy[n]);
+    size_t i;
+    for( i = 0; i < n; i++ ){
+        copy[i] = pieces[i];
+        copy[i].original_specification = copy_string( &p, pieces[i].original_specification );
+        copy[i].unpadded_specification = copy_string( &p, pieces[i].unpadded_specification );
+        copy[i].flags = copy_string( &p, pieces[i].flags );
+        copy[i].field_width = copy_string( &p, pieces[i].field_width );
+        copy[i].precision = copy_string( &p, pieces[i].precision );
+        copy[i].length_modifier = copy_string( &p, pieces[i].length_modifier );
+        copy[i].conversion_specifier = copy_string( &p, pieces[i].conversion_specifier );
+        copy[i].ordinary_text = copy_string( &p, pieces[i].ordinary_text );
+    }
+    return copy;
+}
+
+static struct piece *
+copy_pieces( struct arena *arena, const struct piece *pieces, size_t n ){
+    return flatten_pieces( arena_alloc( arena, pieces_size( pieces, n ) ), pieces, n );
+}
+
+static void
+keep_header( struct ctable *t ){
+    // Copies the first row, and the pieces of its format, out of the
+    // arenas reset after every streamed row.
+    size_t c;
+    struct cell *cell;
+    struct piece *pieces;
+    t->streaming.header_length = t->row_lengths[0];
+    t->streaming.header = arena_alloc( &t->streaming.arena, t->streaming.header_length * sizeof( struct cell ) );
+    pieces = copy_pieces( &t->streaming.arena, t->columns[0].cells[0].piece, t->streaming.header_length );
+    for( c = 0; c < t->streaming.header_length; c++ ){
+        cell = &(t->streaming.header[c]);
+        *cell = t->columns[c].cells[0];
+        cell->piece = &(pieces[c]);
+        if( !cell->piece->is_conversion_specification ){
+            cell->text = cell->piece->ordinary_text;
+        }else if( NULL != cell->text ){
+            archive( &t->streaming.arena, t->columns[c].cells[0].text, cell->length, &(cell->text) );
+        }
+    }
+}
+
+static void
+keep_footer_pieces( struct ctable *t ){
+    // The footers are shaped like a row whose format may be about to
+    // go; a copy of its pieces replaces the last one kept.
+    struct footer *ft = &t->footer;
+    if( NULL == ft->pieces || ft->pieces == ft->kept ){
+        return;
+    }
+    arena_reset( &ft->arena );
+    ft->pieces = ft->kept = copy_pieces( &ft->arena, ft->pieces, ft->npieces );
+}
+
+static void
+drop_uncached_formats( struct ctable *t ){
+    // Once the cache is full, each row compiles a format of its own.
+    // After the row is printed only the header and the footers could
+    // still want its pieces, and they keep copies.
+    if( 0 == t->uncached_format_arena.allocated ){
+        return;
+    }
+    keep_footer_pieces( t );
+    arena_reset( &t->uncached_format_arena );
+}
+
+static void
+stream_row( struct ctable *t ){
+    // Called with the row just captured by _cprintf().
+    size_t c;
+    bool reheader = false;
+    struct cell *cell;
+
+    if( !t->streaming.started ){
+        if( t->nrows < t->streaming.warmup_rows ){
+            return;     // still learning widths
+        }
+        apply_min_widths( t );
+        if( CPRINTF_REHEADER == t->streaming.overflow ){
+            keep_header( t );
+        }
+        phase( t, CPRINTF_PHASE_FORMAT, true );
+        print_something_already( t );
+        phase( t, CPRINTF_PHASE_FORMAT, false );
+        deliver( t );
+        clear_rows( t );
+        drop_uncached_formats( t );
+        t->streaming.started = true;
+        return;
+    }
+
+    // Exactly one row is in the table.  Its widths were not folded
+    // into the columns by _cprintf(); check them against the fixed
+    // widths here.
+    apply_min_widths( t );
+    for( c = 0; c < t->row_lengths[0]; c++ ){
+        cell = &(t->columns[c].cells[0]);
+        if( !cell->piece->is_conversion_specification || cell->width <= t->columns[c].width ){
+            continue;
+        }
+        if( 0 == t->columns[c].width ){
+            // Nothing seen in this column yet; adopt this width.
+            t->columns[c].width = cell->width;
+            continue;
+        }
+        switch( t->streaming.overflow ){
+            case CPRINTF_TRUNCATE:
+                if( NULL == cell->text ){
+                    render_text( &t->arena, cell );     // something to cut
+                }
+                truncate_cell( cell, t->columns[c].width );
+                break;
+            case CPRINTF_REHEADER:
+                reheader = true;
+                // fall through
+            case CPRINTF_WIDEN:
+                t->columns[c].width = cell->width;
+                break;
+        }
+    }
+    phase( t, CPRINTF_PHASE_FORMAT, true );
+    if( reheader ){
+        for( c = 0; c < t->streaming.header_length; c++ ){
+            emit_cell( t, &(t->streaming.header[c]), c < t->ncolumns ? t->columns[c].width : 0 );
+        }
+    }
+    print_something_already( t );
+    phase( t, CPRINTF_PHASE_FORMAT, false );
+    deliver( t );
+    clear_rows( t );
+    drop_uncached_formats( t );
+}
+
+struct format *
+compile_format( struct arena *arena, const char *fmt ){
+    // Splits fmt into pieces.  Adjacent runs of ordinary text (including
+    // the '%' produced by "%%") are merged into a single piece.
+    struct format *f = arena_alloc( arena, sizeof( struct format ) );
+    const char *p = fmt, *q = fmt;
+    ptrdiff_t d = 0;
+    ptrdiff_t span;
+    size_t max_pieces = 1, len;
+    struct piece *piece;
+    char *text;
+
+    // Each '%' can end one piece of ordinary text and start another.
+    for( q = fmt; *q != '\0'; q++ ){
+        if( '%' == *q ){
+            max_pieces += 2;
+        }
+    }
+    len = q - fmt;
+    archive( arena, fmt, len, &(f->fmt) );
+    f->key = fmt;
+    f->pieces = arena_alloc( arena, max_pieces * sizeof( struct piece ) );
+    f->widths = arena_alloc( arena, max_pieces * sizeof( uint32_t ) );
+    // Ordinary text never gets longer than the format itself.
+    text = arena_alloc( arena, len+1 );
+
+    while( *p != '\0' ){
+        d = strcspn( p, "%" );
+        q = p;
+        if( d == 0 && '%' != *(p+1) ){
+            // We've found a converstion specification.
+            piece = &(f->pieces[ f->npieces++ ]);
+            piece->is_conversion_specification = true;
+            piece->ordinary_text = NULL;
+
+            q++; // Skip over initial '%'
+
+            span = parse_flags( q );
+            archive( arena, q, span, &(piece->flags) );
+            q += span;
+
+            span = parse_field_width( q );
+            archive( arena, q, span, &(piece->field_width) );
+            q += span;
+
+            span = parse_precision( q );
+            archive( arena, q, span, &(piece->precision) );
+            q += span;
+
+            span = parse_length_modifier( q );
+            archive( arena, q, span, &(piece->length_modifier) );
+            q += span;
+
+            span = parse_conversion_specifier( q );
+            archive( arena, q, span, &(piece->conversion_specifier) );
+            q += span;
+
+            archive( arena, p, q-p, &(piece->original_specification) );
+            piece->type = decode_type( piece );
+            piece->padding = decode_padding( piece );
+            piece->minimum_width = strtoul( piece->field_width, NULL, 10 );
+            piece->precision_value = '\0' == piece->precision[0] ? -1 : strtol( piece->precision + 1, NULL, 10 );
+            piece->unpadded_specification = NULL;
+            if( piece->minimum_width > 0 && PAD_ZERO != piece->padding
+                    && NULL != strchr( "csp", piece->conversion_specifier[0] ) ){
+                piece->unpadded_specification = arena_alloc( arena, q-p+1 );
+                snprintf( piece->unpadded_specification, q-p+1, "%%%s%s%s%s", piece->flags,
+                          piece->precision, piece->length_modifier, piece->conversion_specifier );
+            }
+            decode_integer( piece );
+            decode_float( piece );
+            p = q;
+        }else{
+            // We've found some normal text.
+            if( 0 == f->npieces || f->pieces[ f->npieces-1 ].is_conversion_specification ){
+                piece = &(f->pieces[ f->npieces++ ]);
+                piece->is_conversion_specification = false;
+                piece->original_specification = piece->unpadded_specification = NULL;
+                piece->flags = piece->field_width = piece->precision = NULL;
+                piece->length_modifier = piece->conversion_specifier = NULL;
+                piece->ordinary_text = text;
+                piece->base = 0;
+                piece->style = '\0';
+            }else{
+                piece = &(f->pieces[ f->npieces-1 ]);
+                text--;     // append to the previous run, over its '\0'
+            }
+            if( d == 0 ){
+                // "%%"
+                *text++ = '%';
+                d = 2;
+            }else{
+                memcpy( text, q, d );
+                text += d;
+            }
+            *text++ = '\0';
+            piece->ordinary_length = text - 1 - piece->ordinary_text;
+            p = q + d;
+        }
+    }
+    return f;
+}
+
+static void
+apply_profile( struct ctable *t, struct format *f ){
+    // Hands a newly compiled format any widths loaded for it.
+    struct profile_entry *e;
+    size_t i, k;
+    for( e = t->profile.entries; NULL != e; e = e->next ){
+        if( 0 != strcmp( e->fmt, f->fmt ) ){
+            continue;
+        }
+        for( i = k = 0; i < f->npieces && k < e->nwidths; i++ ){
+            if( f->pieces[i].is_conversion_specification ){
+                if( e->widths[k] > f->widths[i] ){
+                    f->widths[i] = e->widths[k];
+                }
+                k++;
+            }
+        }
+        return;
+    }
+}
+
+const struct format *
+lookup_format( struct ctable *t, const char *fmt ){
+    // Returns the compiled pieces for fmt, compiling them if this is
+    // the first time we've seen this address with these contents.
+    // Shared tables are read without locking:  a new format is fully
+    // built before it is published at the head of its chain.
+    size_t bucket = ( (uintptr_t)fmt >> 3 ) % FORMAT_CACHE_BUCKETS;
+    struct format *f, *head;
+
+    head = __atomic_load_n( &t->format_cache[ bucket ], __ATOMIC_ACQUIRE );
+    for( f = head; NULL != f; f = f->next ){
+        if( f->key == fmt && 0 == strcmp( f->fmt, fmt ) ){
+            return f;
+        }
+    }
+
+    if( NULL != t->shared ){
+        pthread_mutex_lock( &t->shared->format_lock );
+        // Someone may have compiled it while we waited.
+        for( f = t->format_cache[ bucket ]; f != head && NULL != f; f = f->next ){
+            if( f->key == fmt && 0 == strcmp( f->fmt, fmt ) ){
+                pthread_mutex_unlock( &t->shared->format_lock );
+                return f;
+            }
+        }
+    }
+
+    if( t->format_cache_entries >= FORMAT_CACHE_LIMIT ){
+        // Not the table arena:  streamed and spilled rows outlive it.
+        // A shared table's producers compile into their own scratch
+        // arenas instead, and publish_row() copies the pieces into the
+        // row, which is freed once it is printed.
+        f = compile_format( NULL != t->shared ? &get_default_table()->scratch
+                                              : &t->uncached_format_arena, fmt );
+        f->uncached = true;
+        apply_profile( t, f );
+    }else{
+        f = compile_format( &t->format_arena, fmt );
+        apply_profile( t, f );
+        f->next = t->format_cache[ bucket ];
+        __atomic_store_n( &t->format_cache[ bucket ], f, __ATOMIC_RELEASE );
+        t->format_cache_entries++;
+    }
+
+    if( NULL != t->shared ){
+        pthread_mutex_unlock( &t->shared->format_lock );
+    }
+    return f;
+}
+
+static size_t
+table_bytes( struct ctable *t ){
+    size_t c, bytes = t->arena.allocated + t->nrows * sizeof( uint32_t );
+    for( c = 0; c < t->ncolumns; c++ ){
+        bytes += t->columns[c].ncells * sizeof( struct cell );
+    }
+    return bytes;
+}
+
+static void
+spill_drain( struct ctable *t, const char *p, size_t n ){
+    // Interrupted writes are retried; any other failure (ENOSPC, say)
+    // sets spill.failed and the rest of the batch is dropped.
+    ssize_t rc;
+    while( n > 0 && !t->spill.failed ){
+        rc = write( t->spill.fd, p, n );
+        if( rc < 0 && EINTR == errno ){
+            continue;
+        }
+        if( rc <= 0 ){
+            t->spill.failed = true;
+            return;
+        }
+        p += rc;
+        n -= rc;
+    }
+}
+
+static void
+spill_write( struct ctable *t, const void *p, size_t n ){
+    // Appends to the serialization buffer, writing it out when full.
+    if( t->spill.failed ){
+        return;
+    }
+    if( t->spill.capacity - t->spill.used < n ){
+        spill_drain( t, t->spill.buf, t->spill.used );
+        t->spill.used = 0;
+        if( n > t->spill.capacity ){
+            spill_drain( t, p, n );
+            return;
+        }
+    }
+    memcpy( t->spill.buf + t->spill.used, p, n );
+    t->spill.used += n;
+}
+
+static void
+spill_rows( struct ctable *t ){
+    // Serializes every captured row to the spill file and drops them.
+    // Live frames are compared in memory, and sorted rows are reordered
+    // there, so neither kind of table spills.
+    size_t r, c;
+    uint32_t n;
+    struct cell *cell;
+    struct spilled_cell sc;
+    off_t start;
+
+    if( t->live.enabled || t->sort.nkeys > 0 ){
+        return;
+    }
+    if( -1 == t->spill.fd ){
+        const char *dir = t->spill.directory ? t->spill.directory : getenv( "TMPDIR" );
+        char *path;
+        size_t len;
+        if( NULL == dir ){
+            dir = "/tmp";
+        }
+        len = strlen( dir ) + sizeof( "/cprintf.XXXXXX" );
+        path = malloc( len );
+        assert( path );
+        t->stats.allocations++;
+        snprintf( path, len, "%s/cprintf.XXXXXX", dir );
+        t->spill.fd = mkstemp( path );
+        if( -1 != t->spill.fd ){
+            unlink( path );
+        }
+        free( path );
+        if( -1 == t->spill.fd ){
+            // Nowhere to spill to; keep the rows in memory and stop
+            // trying.
+            t->spill.threshold = 0;
+            return;
+        }
+        t->spill.used = 0;
+    }
+
+    // Each batch is written out in full before its rows are dropped, so
+    // that a failed write costs nothing but the batch:  the file is cut
+    // back to where the batch began, the rows stay in memory, and the
+    // table stops spilling.
+    start = lseek( t->spill.fd, 0, SEEK_CUR );
+    for( c = 0; c < t->ncolumns; c++ ){
+        t->columns[c].next = 0;
+    }
+    for( r = 0; r < t->nrows; r++ ){
+        n = t->row_lengths[r];
+        spill_write( t, &n, sizeof( n ) );
+        for( c = 0; c < n; c++ ){
+            cell = &(t->columns[c].cells[ t->columns[c].next++ ]);
+            memset( &sc, 0, sizeof( sc ) );
+            sc.piece = cell->piece;
+            sc.length = cell->length;
+            sc.width = cell->width;
+            sc.pad = cell->pad;
+            sc.val = cell->val;
+            spill_write( t, &sc, sizeof( sc ) );
+            if( cell->piece->is_conversion_specification && 0 == cell->piece->base ){
+                spill_write( t, cell->text, cell->length );
+            }
+        }
+    }
+    spill_drain( t, t->spill.buf, t->spill.used );
+    t->spill.used = 0;
+    if( t->spill.failed ){
+        // Only the rows before start are read back, whether or not
+        // the space past it can be given back.
+        lseek( t->spill.fd, start, SEEK_SET );
+        while( -1 == ftruncate( t->spill.fd, start ) && EINTR == errno ){
+        }
+        t->spill.failed = false;
+        t->spill.threshold = 0;
+        return;
+    }
+    clear_rows( t );
+}
+
+struct spill_window{
+    char *map;
+    size_t offset;          // file offset of map, page aligned
+    size_t length;
+    size_t total;           // file size
+};
+
+static char *
+spill_at( struct ctable *t, struct spill_window *w, size_t off, size_t n ){
+    // Returns a pointer to bytes [off, off+n) of the spill file,
+    // sliding the mapped window forward as needed so that only
+    // SPILL_WINDOW bytes of the file are mapped at any one time.
+    static size_t page = 0;
+    static char empty[1] = "";
+    if( 0 == n ){
+        return empty;   // may be at the very end of the file
+    }
+    if( 0 == page ){
+        page = sysconf( _SC_PAGESIZE );
+    }
+    if( NULL == w->map || off < w->offset || off + n > w->offset + w->length ){
+        if( NULL != w->map ){
+            munmap( w->map, w->length );
+        }
+        w->offset = off & ~( page - 1 );
+        w->length = SPILL_WINDOW;
+        if( off + n - w->offset > w->length ){
+            w->length = off + n - w->offset;
+        }
+        if( w->offset + w->length > w->total ){
+            w->length = w->total - w->offset;
+        }
+        w->map = mmap( NULL, w->length, PROT_READ, MAP_PRIVATE, t->spill.fd, w->offset );
+        assert( MAP_FAILED != w->map );
+        madvise( w->map, w->length, MADV_SEQUENTIAL );
+    }
+    return w->map + ( off - w->offset );
+}
+
+static void
+open_spilled_rows( struct ctable *t, struct spill_window *w ){
+    // spill_rows() leaves the buffer empty and the file offset at the
+    // end of the last batch it finished, which is where the rows end.
+    w->map = NULL;
+    w->offset = w->length = 0;
+    w->total = lseek( t->spill.fd, 0, SEEK_CUR );
+}
+
+static void
+read_spilled_cell( struct ctable *t, struct spill_window *w, size_t *off, struct cell *cell ){
+    // The text of a conversion points into the window, so it's only
+    // good until the next spill_at().
+    struct spilled_cell sc;
+    memcpy( &sc, spill_at( t, w, *off, sizeof( sc ) ), sizeof( sc ) );
+    *off += sizeof( sc );
+    cell->piece = sc.piece;
+    cell->length = sc.length;
+    cell->width = sc.width;
+    cell->pad = sc.pad;
+    cell->val = sc.val;
+    if( sc.piece->is_conversion_specification && 0 != sc.piece->base ){
+        cell->text = NULL;
+    }else if( sc.piece->is_conversion_specification ){
+        cell->text = spill_at( t, w, *off, sc.length );
+        *off += sc.length;
+    }else{
+        cell->text = sc.piece->ordinary_text;
+    }
+}
+
+static void
+print_spilled_rows( struct ctable *t ){
+    // Maps the file and prints it in a single sequential pass.
+    struct spill_window w;
+    size_t off = 0, c;
+    uint32_t n;
+    struct cell cell;
+
+    open_spilled_rows( t, &w );
+    while( off < w.total ){
+        memcpy( &n, spill_at( t, &w, off, sizeof( n ) ), sizeof( n ) );
+        off += sizeof( n );
+        for( c = 0; c < n; c++ ){
+            read_spilled_cell( t, &w, &off, &cell );
+            emit_cell( t, &cell, t->columns[c].width );
+        }
+    }
+    if( NULL != w.map ){
+        munmap( w.map, w.length );
+    }
+}
+
+// Exports (see ctflush_as()).  Only conversions are exported; the
+// ordinary text between them is dropped.  Integers and floating point
+// values are written from the captured values rather than from their
+// text, and strings (which also take in %c and %p) lose any padding
+// their field width added.
+typedef enum{
+    EXPORT_NULL,
+    EXPORT_INT64,
+    EXPORT_UINT64,
+    EXPORT_FLOAT64,
+    EXPORT_STRING
+}export_kind_t;
+
+// Walks the rows of a table being exported, from memory or, if the
+// table has spilled, from the spill file.  Spilled text is copied into
+// the cursor's arena, as the window it was read from may move before
+// the row is done with.
+struct row_cursor{
+    struct ctable *t;
+    struct spill_window w;
+    size_t off;
+    size_t row;
+    const struct cell **cells;  // the current row, t->ncolumns long
+    struct cell *spilled;       // the cells they point to, if spilled
+    struct arena arena;
+};
+
+// "%.17g", enough digits to read a double back, compiled once for every
+// table rather than taking a slot in each one's format cache.
+static pthread_once_t export_float_once = PTHREAD_ONCE_INIT;
+static struct arena export_float_arena;
+static const struct piece *export_float;
+
+static void
+compile_export_float( void ){
+    export_float = compile_format( &export_float_arena, "%.17g" )->pieces;
+}
+
+static void
+rewind_rows( struct row_cursor *k ){
+    size_t c;
+    k->off = 0;
+    k->row = 0;
+    for( c = 0; c < k->t->ncolumns; c++ ){
+        k->t->columns[c].next = 0;
+    }
+}
+
+static bool
+next_row( struct row_cursor *k, size_t *n ){
+    struct ctable *t = k->t;
+    struct cell *cell;
+    uint32_t length;
+    char *text;
+    size_t c;
+
+    if( -1 != t->spill.fd && k->off < k->w.total ){
+        arena_reset( &k->arena );
+        memcpy( &length, spill_at( t, &k->w, k->off, sizeof( length ) ), sizeof( length ) );
+        k->off += sizeof( length );
+        for( c = 0; c < length; c++ ){
+            k->cells[c] = cell = &(k->spilled[c]);
+            read_spilled_cell( t, &k->w, &k->off, cell );
+            if( NULL != cell->text && cell->piece->is_conversion_specification ){
+                archive( &k->arena, cell->text, cell->length, &text );
+                cell->text = text;
+            }
+        }
+    }else{
+        if( k->row >= t->nrows ){
+            return false;
+        }
+        length = t->row_lengths[ k->row++ ];
+        for( c = 0; c < length; c++ ){
+            k->cells[c] = &(t->columns[c].cells[ t->columns[c].next++ ]);
+        }
+    }
+    *n = length;
+    return true;
+}
+
+static export_kind_t
+export_kind( const struct piece *piece ){
+    char c = piece->conversion_specifier[0];
+    if( NULL != strchr( "di", c ) ){
+        return EXPORT_INT64;
+    }
+    if( NULL != strchr( "ouxX", c ) ){
+        return EXPORT_UINT64;
+    }
+    if( NULL != strchr( "fFeEgGaA", c ) ){
+        return EXPORT_FLOAT64;
+    }
+    return EXPORT_STRING;
+}
+
+static void
+export_text( const struct cell *cell, const char **p, size_t *n ){
+    // A string's text without the spaces its field width added, as
+    // measured when it was rendered.
+    *p = cell->text;
+    *n = cell->length - cell->pad;
+    if( PAD_RIGHT != cell->piece->padding ){
+        *p += cell->pad;
+    }
+}
+
+static double
+export_double( const struct cell *cell ){
+    return C_LONG_DOUBLE == cell->piece->type ? (double)cell->val.c_long_double : cell->val.c_double;
+}
+
+static void
+export_integer( struct ctable *t, uintmax_t v, bool negative ){
+    char buf[24], *p = buf + sizeof( buf );
+    do{
+        *--p = '0' + v % 10;
+        v /= 10;
+    }while( v > 0 );
+    if( negative ){
+        *--p = '-';
+    }
+    output_write( t, p, buf + sizeof( buf ) - p );
+}
+
+static void
+export_quoted( struct ctable *t, const char *p, size_t n, cprintf_export_t form ){
+    // Writes a string as a CSV field (quoted only if it has to be), a
+    // TSV field (with backslash escapes) or a JSON string.
+    static const char hex[] = "0123456789abcdef";
+    const char *special = CPRINTF_CSV == form ? "\"" : CPRINTF_TSV == form ? "\t\r\n\\" : "\"\\";
+    char escape[6];
+    size_t i, run = 0, m;
+    bool quote = CPRINTF_JSONL == form;
+    unsigned char c;
+
+    for( i = 0; i < n && !quote; i++ ){
+        quote = CPRINTF_CSV == form && '\0' != p[i] && NULL != strchr( ",\"\r\n", p[i] );
+    }
+    if( quote ){
+        output_write( t, "\"", 1 );
+    }
+    for( i = 0; i < n; i++ ){
+        c = p[i];
+        if( ( '\0' == c || NULL == strchr( special, c ) ) && ( CPRINTF_JSONL != form || c >= 0x20 ) ){
+            continue;
+        }
+        output_write( t, p + run, i - run );
+        run = i + 1;
+        escape[0] = CPRINTF_CSV == form ? '"' : '\\';
+        m = 2;
+        switch( c ){
+            case '\t':  escape[1] = 't';    break;
+            case '\r':  escape[1] = 'r';    break;
+            case '\n':  escape[1] = 'n';    break;
+            case '"':
+            case '\\':  escape[1] = c;      break;
+            default:
+                // Any other control character in JSON.
+                memcpy( escape, "\\u00", 4 );
+                escape[4] = hex[ c >> 4 ];
+                escape[5] = hex[ c & 0xF ];
+                m = 6;
+                break;
+        }
+        output_write( t, escape, m );
+    }
+    output_write( t, p + run, n - run );
+    if( quote ){
+        output_write( t, "\"", 1 );
+    }
+}
+
+static void
+export_field( struct ctable *t, const struct cell *cell, cprintf_export_t form ){
+    char buf[64];
+    const char *p;
+    size_t n;
+    bool negative;
+    uintmax_t v;
+    double d;
+    int rc;
+
+    switch( export_kind( cell->piece ) ){
+        case EXPORT_INT64:
+        case EXPORT_UINT64:
+            v = integer_magnitude( cell->piece, &(cell->val), &negative );
+            export_integer( t, v, negative );
+            break;
+        case EXPORT_FLOAT64:
+            // Enough digits to read back the same value.
+            if( C_LONG_DOUBLE == cell->piece->type ){
+                rc = snprintf( buf, sizeof( buf ), "%.*Lg", LDBL_DECIMAL_DIG, cell->val.c_long_double );
+            }else if( ( rc = format_float( buf, sizeof( buf ), export_float, &(cell->val) ) ) < 0 ){
+                rc = snprintf( buf, sizeof( buf ), "%.17g", cell->val.c_double );
+            }
+            d = export_double( cell );
+            if( CPRINTF_JSONL == form && ( d != d || d - d != 0 ) ){
+                output_write( t, "null", 4 );   // nan and inf aren't JSON
+            }else{
+                output_write( t, buf, rc );
+            }
+            break;
+        default:
+            export_text( cell, &p, &n );
+            export_quoted( t, p, n, form );
+            break;
+    }
+}
+
+static void
+export_delimited( struct ctable *t, struct row_cursor *k, cprintf_export_t form ){
+    // CSV, TSV or JSON Lines, a record per row.
+    const char *separator = CPRINTF_TSV == form ? "\t" : ",";
+    size_t n, c, fields;
+
+    while( next_row( k, &n ) ){
+        if( CPRINTF_JSONL == form ){
+            output_write( t, "[", 1 );
+        }
+        for( c = fields = 0; c < n; c++ ){
+            if( !k->cells[c]->piece->is_conversion_specification ){
+                continue;
+            }
+            if( fields++ > 0 ){
+                output_write( t, separator, 1 );
+            }
+            export_field( t, k->cells[c], form );
+        }
+        output_write( t, CPRINTF_JSONL == form ? "]\n" : "\n", CPRINTF_JSONL == form ? 2 : 1 );
+    }
+}
+
+static void
+export_bytes( struct ctable *t, uint64_t v, size_t n ){
+    // The low n bytes of v, little-endian.
+    char b[8];
+    size_t i;
+    for( i = 0; i < n; i++ ){
+        b[i] = v >> ( 8 * i );
+    }
+    output_write( t, b, n );
+}
+
+static const struct cell *
+nth_conversion( const struct row_cursor *k, size_t n, size_t i ){
+    size_t c;
+    for( c = 0; c < n; c++ ){
+        if( k->cells[c]->piece->is_conversion_specification && 0 == i-- ){
+            return k->cells[c];
+        }
+    }
+    return NULL;
+}
+
+static void
+export_binary( struct ctable *t, struct row_cursor *k ){
+    // The binary columnar form.  Everything is little-endian.
+    //
+    //  "CPRINTF1"
+    //  uint64_t rows
+    //  uint32_t columns
+    //  per column:  uint8_t kind (1 int64, 2 uint64, 3 float64 and
+    //      4 string), uint8_t length, and that many bytes of the
+    //      conversion specification the column was first seen with
+    //  per column:  the values, then (rows + 7) / 8 bytes with bit
+    //      r % 8 of byte r / 8 set if row r has a value
+    //
+    // Numeric values take 8 bytes each (0 where there is none).  A
+    // string column is rows + 1 uint64_t offsets followed by the bytes
+    // they point into.  Column i holds the ith conversion of each row,
+    // and rows where that conversion is missing or of another kind have
+    // no value.  Each column takes a pass or two over the rows.
+    const struct piece **pieces = NULL;
+    const struct cell *cell;
+    unsigned char *valid, kind;
+    size_t nrows = 0, ncolumns = 0, n, i, r, c, capacity = 0, length;
+    uint64_t offset, u;
+    bool negative = false;
+    const char *p;
+    double d;
+
+    // First pass:  the schema.
+    while( next_row( k, &n ) ){
+        nrows++;
+        for( c = i = 0; c < n; c++ ){
+            if( !k->cells[c]->piece->is_conversion_specification ){
+                continue;
+            }
+            if( i >= capacity ){
+                capacity = capacity ? capacity * 2 : 16;
+                pieces = realloc( pieces, capacity * sizeof( struct piece * ) );
+                assert( pieces );
+                t->stats.allocations++;
+            }
+            if( i >= ncolumns ){
+                pieces[ ncolumns++ ] = k->cells[c]->piece;
+            }
+            i++;
+        }
+    }
+    valid = malloc( ( nrows + 7 ) / 8 + 1 );
+    assert( valid );
+    t->stats.allocations++;
+
+    output_write( t, "CPRINTF1", 8 );
+    export_bytes( t, nrows, 8 );
+    export_bytes( t, ncolumns, 4 );
+    for( i = 0; i < ncolumns; i++ ){
+        length = strlen( pieces[i]->original_specification );
+        length = length > UINT8_MAX ? UINT8_MAX : length;
+        export_bytes( t, export_kind( pieces[i] ), 1 );
+        export_bytes( t, length, 1 );
+        output_write( t, pieces[i]->original_specification, length );
+    }
+
+    for( i = 0; i < ncolumns; i++ ){
+        kind = export_kind( pieces[i] );
+        memset( valid, 0, ( nrows + 7 ) / 8 + 1 );
+        offset = 0;
+        if( EXPORT_STRING == kind ){
+            export_bytes( t, 0, 8 );
+        }
+        rewind_rows( k );
+        for( r = 0; next_row( k, &n ); r++ ){
+            cell = nth_conversion( k, n, i );
+            if( NULL != cell && export_kind( cell->piece ) != kind ){
+                cell = NULL;
+            }
+            if( NULL != cell ){
+                valid[ r / 8 ] |= 1 << ( r % 8 );
+            }
+            switch( kind ){
+                case EXPORT_INT64:
+                case EXPORT_UINT64:
+                    u = NULL == cell ? 0 : integer_magnitude( cell->piece, &(cell->val), &negative );
+                    export_bytes( t, negative && NULL != cell ? (uint64_t)0 - u : u, 8 );
+                    break;
+                case EXPORT_FLOAT64:
+                    d = NULL == cell ? 0 : export_double( cell );
+                    memcpy( &u, &d, sizeof( u ) );
+                    export_bytes( t, u, 8 );
+                    break;
+                default:
+                    if( NULL != cell ){
+                        export_text( cell, &p, &length );
+                        offset += length;
+                    }
+                    export_bytes( t, offset, 8 );
+                    break;
+            }
+        }
+        if( EXPORT_STRING == kind ){
+            rewind_rows( k );
+            while( next_row( k, &n ) ){
+                cell = nth_conversion( k, n, i );
+                if( NULL != cell && EXPORT_STRING == export_kind( cell->piece ) ){
+                    export_text( cell, &p, &length );
+                    output_write( t, p, length );
+                }
+            }
+        }
+        output_write( t, (const char *)valid, ( nrows + 7 ) / 8 );
+    }
+    free( valid );
+    free( pieces );
+}
+
+static void
+export_rows( struct ctable *t, cprintf_export_t form ){
+    struct row_cursor k;
+    memset( &k, 0, sizeof( k ) );
+    k.t = t;
+    if( -1 != t->spill.fd ){
+        spill_rows( t );
+        open_spilled_rows( t, &k.w );
+    }
+    k.cells = malloc( ( t->ncolumns + 1 ) * sizeof( struct cell * ) );
+    k.spilled = malloc( ( t->ncolumns + 1 ) * sizeof( struct cell ) );
+    assert( k.cells && k.spilled );
+    t->stats.allocations += 2;
+    pthread_once( &export_float_once, compile_export_float );
+    rewind_rows( &k );
+    if( CPRINTF_BINARY == form ){
+        export_binary( t, &k );
+    }else{
+        export_delimited( t, &k, form );
+    }
+    free( k.cells );
+    free( k.spilled );
+    arena_free( &k.arena );
+    if( -1 != t->spill.fd ){
+        if( NULL != k.w.map ){
+            munmap( k.w.map, k.w.length );
+        }
+        close( t->spill.fd );
+        t->spill.fd = -1;
+    }
+}
+
+static void
+reserve_keys( struct ctable *t ){
+    // Room to take the keys of every row the table has room for.
+    struct sort *s = &t->sort;
+    if( s->capacity < t->row_capacity ){
+        s->capacity = t->row_capacity;
+        s->rows = realloc( s->rows, s->capacity * sizeof( struct sort_row ) );
+        s->values = realloc( s->values, s->capacity * s->nkeys * sizeof( struct sort_value ) );
+        assert( s->rows && s->values );
+        t->stats.allocations += 2;
+    }
+    if( s->at_capacity < t->column_capacity ){
+        s->at_capacity = t->column_capacity;
+        s->at = realloc( s->at, s->at_capacity * sizeof( size_t ) );
+        assert( s->at );
+        t->stats.allocations++;
+    }
+}
+
+static void
+take_keys( struct ctable *t, size_t r ){
+    // Fills in row r's values from its cells, s->at[c] being the row's
+    // cell in column c.
+    struct sort *s = &t->sort;
+    struct sort_row *row = &(s->rows[r]);
+    struct sort_value *v;
+    const struct cell *cell;
+    size_t c, j, k;
+    uint32_t found = 0;
+
+    row->kinds = 0;
+    row->dead = false;
+    for( c = k = 0; c < t->row_lengths[r]; c++ ){
+        cell = &(t->columns[c].cells[ s->at[c] ]);
+        if( !cell->piece->is_conversion_specification ){
+            continue;
+        }
+        for( j = 0; j < s->nkeys; j++ ){
+            if( s->keys[j].conversion != k ){
+                continue;
+            }
+            v = &(s->values[ r * s->nkeys + j ]);
+            memset( v, 0, sizeof( *v ) );
+            v->descending = s->keys[j].descending;
+            switch( export_kind( cell->piece ) ){
+                case EXPORT_INT64:
+                case EXPORT_UINT64:
+                    v->number = true;
+                    v->magnitude = integer_magnitude( cell->piece, &(cell->val), &(v->negative) );
+                    v->x = v->negative ? -(long double)v->magnitude : (long double)v->magnitude;
+                    break;
+                case EXPORT_FLOAT64:
+                    v->number = v->real = true;
+                    v->x = C_LONG_DOUBLE == cell->piece->type ? cell->val.c_long_double : cell->val.c_double;
+                    v->nan = isnan( v->x );
+                    break;
+                default:
+                    export_text( cell, &(v->text), &(v->length) );
+                    break;
+            }
+            row->kinds |= (uint32_t)v->number << j;
+            found |= (uint32_t)1 << j;
+        }
+        k++;
+    }
+    row->complete = found == (uint32_t)( ( (uint64_t)1 << s->nkeys ) - 1 );
+}
+
+static void
+take_all_keys( struct ctable *t ){
+    size_t r, c;
+    reserve_keys( t );
+    memset( t->sort.at, 0, t->ncolumns * sizeof( size_t ) );
+    for( r = 0; r < t->nrows; r++ ){
+        take_keys( t, r );
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            t->sort.at[c]++;
+        }
+    }
+    t->sort.taken = t->nrows;
+}
+
+static int
+compare_values( const struct sort_value *a, const struct sort_value *b ){
+    // Integers exactly, other numbers as long double, strings byte by
+    // byte.
+    int c;
+    if( !a->number ){
+        c = memcmp( a->text, b->text, a->length < b->length ? a->length : b->length );
+        return c ? c : ( a->length > b->length ) - ( a->length < b->length );
+    }
+    if( !a->real && !b->real ){
+        if( a->negative != b->negative ){
+            return a->negative ? -1 : 1;
+        }
+        c = ( a->magnitude > b->magnitude ) - ( a->magnitude < b->magnitude );
+        return a->negative ? -c : c;
+    }
+    return ( a->x > b->x ) - ( a->x < b->x );
+}
+
+static int
+compare_keys( const struct sort_value *a, const struct sort_value *b, size_t nkeys ){
+    // Negative if a's row goes first.  NaN goes last either way.
+    size_t k;
+    int c;
+    for( k = 0; k < nkeys; k++ ){
+        if( a[k].nan || b[k].nan ){
+            if( 0 != ( c = a[k].nan - b[k].nan ) ){
+                return c;
+            }
+            continue;
+        }
+        if( 0 != ( c = compare_values( &a[k], &b[k] ) ) ){
+            return a[k].descending ? -c : c;
+        }
+    }
+    return 0;
+}
+
+struct sort_entry{
+    uint64_t prefix;
+    const struct sort_value *values;
+    uint32_t row;
+    uint16_t nkeys;
+    bool exact;                 // the prefix is the whole first key
+};
+
+static uint64_t
+key_prefix( const struct sort_value *v, bool *exact ){
+    // Orders rows as their first key does, as far as 64 bits can tell,
+    // so that most comparisons needn't look at the values:  numbers by
+    // the bits of the nearest double, strings by their first 8 bytes.
+    uint64_t u = 0;
+    double d;
+    size_t i;
+    *exact = true;
+    if( v->nan ){
+        return UINT64_MAX;
+    }
+    if( v->number ){
+        d = (double)v->x;
+        if( 0 == d ){
+            d = 0;      // not -0
+        }
+        *exact = v->real ? d == v->x : v->magnitude <= (uintmax_t)1 << DBL_MANT_DIG;
+        memcpy( &u, &d, sizeof( u ) );
+        u = u >> 63 ? ~u : u | (uint64_t)1 << 63;
+    }else{
+        for( i = 0; i < 8; i++ ){
+            u = u << 8 | ( i < v->length ? (unsigned char)v->text[i] : 0 );
+        }
+        *exact = v->length < 8 && NULL == memchr( v->text, '\0', v->length );
+    }
+    return v->descending ? ~u : u;
+}
+
+static int
+compare_entries( const void *a, const void *b ){
+    // Ties keep the order rows were appended in.
+    const struct sort_entry *x = a, *y = b;
+    int c;
+    if( x->prefix != y->prefix ){
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    c = compare_keys( x->values, y->values, x->nkeys );
+    return c ? c : ( x->row > y->row ) - ( x->row < y->row );
+}
+
+static void
+radix_sort( struct sort_entry *a, struct sort_entry *b, size_t n ){
+    // Stable, by prefix, a byte at a time from the lowest, skipping
+    // bytes every entry shares.  b is as long as a; a ends up sorted.
+    struct sort_entry *from = a, *to = b;
+    size_t counts[256], i, sum, x;
+    int shift;
+    for( shift = 0; shift < 64 && n > 1; shift += 8 ){
+        memset( counts, 0, sizeof( counts ) );
+        for( i = 0; i < n; i++ ){
+            counts[ from[i].prefix >> shift & 0xff ]++;
+        }
+        if( n == counts[ from[0].prefix >> shift & 0xff ] ){
+            continue;
+        }
+        for( i = sum = 0; i < 256; i++ ){
+            x = counts[i];
+            counts[i] = sum;
+            sum += x;
+        }
+        for( i = 0; i < n; i++ ){
+            to[ counts[ from[i].prefix >> shift & 0xff ]++ ] = from[i];
+        }
+        SWAP( from, to );
+    }
+    if( from != a ){
+        memcpy( a, from, n * sizeof( struct sort_entry ) );
+    }
+}
+
+static bool
+sorts_before( const struct sort *s, uint32_t a, uint32_t b ){
+    int c = compare_keys( &(s->values[ a * s->nkeys ]), &(s->values[ b * s->nkeys ]), s->nkeys );
+    return c ? c < 0 : a < b;
+}
+
+static void
+sift_down( struct sort *s, size_t i ){
+    size_t child;
+    while( ( child = 2 * i + 1 ) < s->nheap ){
+        if( child + 1 < s->nheap && sorts_before( s, s->heap[child], s->heap[ child+1 ] ) ){
+            child++;
+        }
+        if( !sorts_before( s, s->heap[i], s->heap[child] ) ){
+            return;
+        }
+        SWAP( s->heap[i], s->heap[child] );
+        i = child;
+    }
+}
+
+static void
+offer_row( struct ctable *t, uint32_t r ){
+    // Puts row r in the heap if it's among the top rows so far, and
+    // marks whichever row that leaves out dead.
+    struct sort *s = &t->sort;
+    size_t i;
+    if( s->nheap < s->top ){
+        if( s->nheap == s->heap_capacity ){
+            s->heap_capacity = s->heap_capacity ? s->heap_capacity * 2 : 1024;
+            s->heap = realloc( s->heap, s->heap_capacity * sizeof( uint32_t ) );
+            assert( s->heap );
+            t->stats.allocations++;
+        }
+        for( i = s->nheap++; i > 0 && sorts_before( s, s->heap[ (i-1)/2 ], r ); i = (i-1)/2 ){
+            s->heap[i] = s->heap[ (i-1)/2 ];
+        }
+        s->heap[i] = r;
+        return;
+    }
+    if( !sorts_before( s, r, s->heap[0] ) ){
+        s->rows[r].dead = true;
+        s->ndead++;
+        return;
+    }
+    s->rows[ s->heap[0] ].dead = true;
+    s->ndead++;
+    s->heap[0] = r;
+    sift_down( s, 0 );
+}
+
+static bool
+candidate( const struct sort *s, size_t r ){
+    return !s->rows[r].dead && s->rows[r].complete && s->have_pattern && s->rows[r].kinds == s->pattern;
+}
+
+static void
+rebuild_rows( struct ctable *t, const uint32_t *order, size_t n, bool fresh ){
+    // Rearranges the table into the rows listed in order, dropping any
+    // left out, a column at a time through one scratch column.  With
+    // fresh set, the text of the rows kept is copied into a new arena
+    // and the old one is emptied.
+    struct sort *s = &t->sort;
+    size_t r, c, i, k, ncells = 0;
+    size_t *starts = NULL, *where = NULL, *counts;
+    uint32_t *lengths;
+    bool uniform = true, same;
+    struct cell *cell;
+
+    for( r = 0; r < t->nrows; r++ ){
+        ncells += t->row_lengths[r];
+        uniform = uniform && t->row_lengths[r] == t->row_lengths[0];
+    }
+    lengths = malloc( ( n + 1 ) * sizeof( uint32_t ) );
+    assert( lengths );
+    t->stats.allocations++;
+    if( !uniform ){
+        // Where each row's cell is in each column.  When every row is
+        // as long, it's at the row's own number.
+        starts = malloc( t->nrows * sizeof( size_t ) );
+        where = malloc( ncells * sizeof( size_t ) );
+        counts = calloc( t->ncolumns, sizeof( size_t ) );
+        assert( starts && where && counts );
+        t->stats.allocations += 3;
+        for( r = 0, ncells = 0; r < t->nrows; r++ ){
+            starts[r] = ncells;
+            for( c = 0; c < t->row_lengths[r]; c++ ){
+                where[ ncells++ ] = counts[c]++;
+            }
+        }
+        free( counts );
+    }
+
+    for( c = 0; c < t->ncolumns; c++ ){
+        // A column of nothing but the same ordinary text, such as the
+        // spaces between conversions, only needs cutting short.
+        cell = t->columns[c].cells;
+        same = t->columns[c].ncells > 0 && !cell->piece->is_conversion_specification;
+        for( i = 1; same && i < t->columns[c].ncells; i++ ){
+            same = cell[i].piece == cell->piece;
+        }
+        if( same ){
+            for( i = k = 0; i < n; i++ ){
+                k += t->row_lengths[ order[i] ] > c;
+            }
+            t->columns[c].ncells = k;
+            continue;
+        }
+        if( s->scratch_capacity < t->columns[c].ncells ){
+            s->scratch_capacity = t->columns[c].capacity;
+            free( s->scratch );
+            s->scratch = malloc( s->scratch_capacity * sizeof( struct cell ) );
+            assert( s->scratch );
+            t->stats.allocations++;
+        }
+        for( i = k = 0; i < n; i++ ){
+            r = order[i];
+            if( t->row_lengths[r] <= c ){
+                continue;
+            }
+            cell = &(s->scratch[ k++ ]);
+            *cell = t->columns[c].cells[ uniform ? r : where[ starts[r] + c ] ];
+            if( fresh && cell->piece->is_conversion_specification && NULL != cell->text ){
+                intern( &s->arena, cell->text, cell->length, &(cell->text) );
+            }
+        }
+        memcpy( t->columns[c].cells, s->scratch, k * sizeof( struct cell ) );
+        t->columns[c].ncells = k;
+    }
+    for( i = 0; i < n; i++ ){
+        lengths[i] = t->row_lengths[ order[i] ];
+    }
+    memcpy( t->row_lengths, lengths, n * sizeof( uint32_t ) );
+    t->nrows = n;
+    if( fresh ){
+        SWAP( t->arena, s->arena );
+        arena_reset( &s->arena );
+    }
+    free( starts );
+    free( where );
+    free( lengths );
+}
+
+static void
+compact_rows( struct ctable *t ){
+    // Drops the dead rows and rebuilds the heap from the rows left.
+    struct sort *s = &t->sort;
+    uint32_t *order = malloc( ( t->nrows + 1 ) * sizeof( uint32_t ) );
+    size_t r, n = 0;
+    assert( order );
+    t->stats.allocations++;
+    for( r = 0; r < t->nrows; r++ ){
+        if( !s->rows[r].dead ){
+            order[ n++ ] = r;
+        }
+    }
+    rebuild_rows( t, order, n, true );
+    free( order );
+    take_all_keys( t );
+    s->nheap = s->ndead = s->dropped = 0;
+    for( r = 0; r < t->nrows; r++ ){
+        if( candidate( s, r ) ){
+            offer_row( t, r );
+        }
+    }
+}
+
+static void
+select_row( struct ctable *t ){
+    // Called with the row just captured by _cprintf() when only the
+    // top rows are wanted.
+    struct sort *s = &t->sort;
+    size_t r = t->nrows - 1, c, q;
+
+    reserve_keys( t );
+    for( c = 0; c < t->row_lengths[r]; c++ ){
+        s->at[c] = t->columns[c].ncells - 1;
+    }
+    take_keys( t, r );
+    s->taken = t->nrows;
+    if( !s->rows[r].complete ){
+        return;
+    }
+    if( !s->have_pattern || s->rows[r].kinds != s->pattern ){
+        // The rows picked so far aren't like this one, and so are
+        // printed ahead of the sorted rows; start again with any that are.
+        s->pattern = s->rows[r].kinds;
+        s->have_pattern = true;
+        s->nheap = 0;
+        for( q = 0; q < r; q++ ){
+            if( candidate( s, q ) ){
+                offer_row( t, q );
+            }
+        }
+    }
+    offer_row( t, r );
+    if( s->rows[r].dead ){
+        for( c = 0; c < t->row_lengths[r]; c++ ){
+            t->columns[c].ncells--;
+        }
+        t->nrows = s->taken = r;
+        s->ndead--;
+        s->dropped++;
+    }
+    if( s->ndead + s->dropped >= ( s->top > SORT_SLACK ? s->top : SORT_SLACK ) ){
+        compact_rows( t );
+    }
+}
+
+static void
+sort_rows( struct ctable *t ){
+    // Puts the rows in order of their keys, after the rows that aren't
+    // like the last complete row, and keeps only the top rows of them.
+    struct sort *s = &t->sort;
+    struct sort_entry *entries;
+    uint32_t *order;
+    size_t r, c, i, j, n = 0, m = 0, width, before = t->nrows;
+    bool moved = false, exact;
+
+    if( 0 == t->nrows ){
+        return;
+    }
+    if( s->taken < t->nrows ){
+        take_all_keys( t );
+    }
+    for( r = t->nrows; r-- > 0; ){
+        if( !s->rows[r].dead && s->rows[r].complete ){
+            s->pattern = s->rows[r].kinds;
+            s->have_pattern = true;
+            break;
+        }
+    }
+
+    order = malloc( t->nrows * sizeof( uint32_t ) );
+    entries = malloc( 2 * t->nrows * sizeof( struct sort_entry ) );
+    assert( order && entries );
+    t->stats.allocations += 2;
+    for( r = 0; r < t->nrows; r++ ){
+        if( candidate( s, r ) ){
+            entries[ m ].values = &(s->values[ r * s->nkeys ]);
+            entries[ m ].prefix = key_prefix( entries[ m ].values, &(entries[ m ].exact) );
+            entries[ m ].row = r;
+            entries[ m ].nkeys = s->nkeys;
+            m++;
+        }else if( !s->rows[r].dead ){
+            order[ n++ ] = r;
+        }
+    }
+    // Rows are sorted by prefix, and only runs of rows that share one
+    // need their values compared, unless the prefix was the only key
+    // and all of it.
+    radix_sort( entries, entries + t->nrows, m );
+    for( i = 0; i < m; i = j ){
+        exact = 1 == s->nkeys && entries[i].exact;
+        for( j = i + 1; j < m && entries[j].prefix == entries[i].prefix; j++ ){
+            exact = exact && entries[j].exact;
+        }
+        if( j - i > 1 && !exact ){
+            qsort( entries + i, j - i, sizeof( struct sort_entry ), compare_entries );
+        }
+    }
+    if( s->top > 0 && m > s->top ){
+        m = s->top;
+    }
+    for( i = 0; i < m; i++ ){
+        order[ n++ ] = entries[i].row;
+    }
+    for( i = 0; i < n && !moved; i++ ){
+        moved = order[i] != i;
+    }
+    if( moved || n < before ){
+        rebuild_rows( t, order, n, false );
+    }
+
+    // Rows left out, here or as they were appended, may have been the
+    // widest.  Sticky widths only grow.
+    if( ( n < before || s->top > 0 ) && !t->sticky ){
+        for( c = 0; c < t->ncolumns; c++ ){
+            for( i = 0, width = 0; i < t->columns[c].ncells; i++ ){
+                if( t->columns[c].cells[i].piece->is_conversion_specification
+                 && t->columns[c].cells[i].width > width ){
+                    width = t->columns[c].cells[i].width;
+                }
+            }
+            t->columns[c].width = width;
+        }
+    }
+    free( order );
+    free( entries );
+}
+
+static bool
+accumulate( struct ctable *t, size_t column, const struct cell *cell ){
+    // Adds a cell to its column's aggregate if it's a number.
+    struct footer *ft = &t->footer;
+    struct aggregate *a;
+    uintmax_t v;
+    bool negative;
+    int128_t i;
+    long double x;
+
+    // export_kind() by type, as this is called for every cell.
+    switch( cell->piece->type ){
+        case C_CHARX:
+        case C_WCHAR_TX:
+        case C_WINT_T:
+        case C_VOIDX:
+            return false;
+        case C_INT:
+            if( 'c' == cell->piece->conversion_specifier[0] ){
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+    if( column >= ft->capacity ){
+        size_t n = ft->capacity ? ft->capacity * 2 : 16;
+        while( n <= column ){
+            n *= 2;
+        }
+        ft->columns = realloc( ft->columns, n * sizeof( struct aggregate ) );
+        assert( ft->columns );
+        t->stats.allocations++;
+        memset( ft->columns + ft->capacity, 0, ( n - ft->capacity ) * sizeof( struct aggregate ) );
+        ft->capacity = n;
+    }
+    a = &(ft->columns[ column ]);
+    if( C_DOUBLE == cell->piece->type || C_LONG_DOUBLE == cell->piece->type ){
+        x = C_LONG_DOUBLE == cell->piece->type ? cell->val.c_long_double : cell->val.c_double;
+        a->real_sum += x;
+        if( 0 == a->reals++ || x < a->real_lowest ){
+            a->real_lowest = x;
+        }
+        if( 1 == a->reals || x > a->real_highest ){
+            a->real_highest = x;
+        }
+        return true;
+    }
+    v = integer_magnitude( cell->piece, &(cell->val), &negative );
+    i = negative ? -(int128_t)v : (int128_t)v;
+    a->sum += i;
+    if( 0 == a->integers++ || i < a->lowest ){
+        a->lowest = i;
+    }
+    if( 1 == a->integers || i > a->highest ){
+        a->highest = i;
+    }
+    return true;
+}
+
+static bool
+aggregate_value( const struct aggregate *a, int which, int128_t *i, long double *x ){
+    // One aggregate of a column, in *i if it's still an integer and in
+    // *x (returning true) if any value wasn't.  Integer means are
+    // rounded to the nearest integer, half away from zero.
+    uint64_t n = a->integers + a->reals;
+    int128_t r;
+    if( 0 == a->reals ){
+        switch( which ){
+            case CPRINTF_SUM:   *i = a->sum;        break;
+            case CPRINTF_MIN:   *i = a->lowest;     break;
+            case CPRINTF_MAX:   *i = a->highest;    break;
+            default:
+                *i = a->sum / (int128_t)n;
+                r = a->sum % (int128_t)n;
+                if( 2 * ( r < 0 ? -r : r ) >= (int128_t)n ){
+                    *i += a->sum < 0 ? -1 : 1;
+                }
+                break;
+        }
+        return false;
+    }
+    switch( which ){
+        case CPRINTF_SUM:
+            *x = a->real_sum + (long double)a->sum;
+            break;
+        case CPRINTF_MIN:
+            *x = a->integers > 0 && (long double)a->lowest < a->real_lowest ? (long double)a->lowest : a->real_lowest;
+            break;
+        case CPRINTF_MAX:
+            *x = a->integers > 0 && (long double)a->highest > a->real_highest ? (long double)a->highest : a->real_highest;
+            break;
+        default:
+            *x = ( a->real_sum + (long double)a->sum ) / n;
+            break;
+    }
+    return true;
+}
+
+static void
+footer_spec( char **q, const char *flags, const struct piece *piece, bool precision,
+             const char *modifier, char conversion ){
+    // piece's field width, and its precision if wanted, for a footer
+    // value of another type.
+    *q += sprintf( *q, "%%%s%s%s%s%c", flags, piece->field_width,
+                   precision ? piece->precision : "", modifier, conversion );
+}
+
+static void
+append_footer( struct ctable *t, int which, const char *label ){
+    // One footer row, in the shape of the last row with a number.  Each
+    // numeric column's value is printed with that row's specification,
+    // widened to intmax_t or long double; integers that don't fit are
+    // printed as %.0Lf.  The first %s or %ls gets the label, and
+    // anything else, %c and %p included, is left blank.
+    struct footer *ft = &t->footer;
+    struct arguments a = { NULL, ft->args, 0, 0, NULL, 0 };
+    const struct piece *piece;
+    const char *p;
+    cprintf_arg_t *arg;
+    char *q = ft->fmt, c;
+    export_kind_t kind;
+    size_t k;
+    int128_t i = 0;
+    long double x = 0;
+    bool labelled = false;
+
+    for( k = 0; k < ft->npieces; k++ ){
+        piece = &(ft->pieces[k]);
+        if( !piece->is_conversion_specification ){
+            for( p = piece->ordinary_text; p < piece->ordinary_text + piece->ordinary_length; p++ ){
+                *q++ = *p;
+                if( '%' == *p ){
+                    *q++ = '%';
+                }
+            }
+            continue;
+        }
+        arg = &(ft->args[ a.count++ ]);
+        kind = export_kind( piece );
+        c = piece->conversion_specifier[0];
+        if( EXPORT_STRING == kind || k >= ft->capacity || 0 == ft->columns[k].integers + ft->columns[k].reals ){
+            footer_spec( &q, NULL != strchr( piece->flags, '-' ) ? "-" : "", piece, false, "", 's' );
+            *arg = cprintf_arg_string( 's' == c && !labelled ? label : "" );
+            labelled = labelled || 's' == c;
+            continue;
+        }
+        if( aggregate_value( &(ft->columns[k]), which, &i, &x ) ){
+            if( EXPORT_FLOAT64 != kind && x > -1e38L && x < 1e38L ){
+                i = (int128_t)( x < 0 ? x - 0.5L : x + 0.5L );
+                kind = x < 0 ? EXPORT_INT64 : kind;     // which o, u, x and X can't show
+            }else{
+                kind = EXPORT_FLOAT64;
+            }
+        }else{
+            x = (long double)i;
+        }
+        if( EXPORT_INT64 == kind && NULL != strchr( "di", c ) && i >= INTMAX_MIN && i <= INTMAX_MAX ){
+            footer_spec( &q, piece->flags, piece, true, "j", c );
+            *arg = cprintf_arg_signed( (intmax_t)i );
+        }else if( EXPORT_UINT64 == kind && i >= 0 && i <= UINTMAX_MAX ){
+            footer_spec( &q, piece->flags, piece, true, "j", c );
+            *arg = cprintf_arg_unsigned( (uintmax_t)i );
+        }else if( EXPORT_FLOAT64 == kind && NULL != strchr( "fFeEgGaA", c ) ){
+            footer_spec( &q, piece->flags, piece, true, "L", c );
+            *arg = cprintf_arg_long_double( x );
+        }else{
+            footer_spec( &q, piece->flags, piece, false, ".0L", 'f' );
+            *arg = cprintf_arg_long_double( x );
+        }
+    }
+    *q = '\0';
+    _cprintf( t, NULL, ft->fmt, &a );
+}
+
+static void
+append_footers( struct ctable *t ){
+    // At flush, before the rows are printed:  a footer row for each
+    // aggregate asked for, then the aggregates start again.  Exports
+    // get no footers.
+    static const struct{ int which; const char *label; }footers[] = {
+        { CPRINTF_SUM, "sum" },
+        { CPRINTF_MIN, "min" },
+        { CPRINTF_MAX, "max" },
+        { CPRINTF_MEAN, "mean" }
+    };
+    struct footer *ft = &t->footer;
+    size_t k, size = 1;
+
+    if( NULL != ft->pieces && CPRINTF_TEXT == t->form ){
+        for( k = 0; k < ft->npieces; k++ ){
+            size += ft->pieces[k].is_conversion_specification
+                  ? strlen( ft->pieces[k].original_specification ) + 8
+                  : 2 * ft->pieces[k].ordinary_length;
+        }
+        if( size > ft->size ){
+            ft->size = size;
+            ft->fmt = realloc( ft->fmt, ft->size );
+            assert( ft->fmt );
+            t->stats.allocations++;
+        }
+        if( ft->npieces > ft->nargs ){
+            ft->nargs = ft->npieces;
+            ft->args = realloc( ft->args, ft->nargs * sizeof( cprintf_arg_t ) );
+            assert( ft->args );
+            t->stats.allocations++;
+        }
+        ft->appending = true;
+        for( k = 0; k < sizeof( footers ) / sizeof( footers[0] ); k++ ){
+            if( ft->aggregates & footers[k].which ){
+                append_footer( t, footers[k].which, footers[k].label );
+            }
+        }
+        ft->appending = false;
+    }
+    if( NULL != ft->columns ){
+        memset( ft->columns, 0, ft->capacity * sizeof( struct aggregate ) );
+    }
+    ft->pieces = ft->kept = NULL;
+    ft->npieces = 0;
+}
+
+static void publish_row( struct ctable *t, int64_t key, const char *fmt, struct arguments *args );
+
+static void
+learn_width( struct ctable *t, const struct format *f, size_t i, size_t width ){
+    // The width the format has learned for piece i is a floor for its
+    // column, as if it were one of ctstream()'s min_widths.  Values a
+    // stream truncated aren't learned, as they were never printed.
+    if( f->widths[i] > t->columns[i].width ){
+        t->columns[i].width = f->widths[i];
+    }
+    if( width > f->widths[i] && !( t->streaming.started && CPRINTF_TRUNCATE == t->streaming.overflow ) ){
+        assert( width <= UINT32_MAX );
+        f->widths[i] = width;
+    }
+}
+
+static void
+use_sink( struct ctable *t, const struct sink *sink ){
+    if( NULL != sink ){
+        if( SINK_NONE == t->sink.kind ){
+            t->sink = *sink;
+        }
+        // This fails if subsequent destinations don't match the initial one.
+        assert( t->sink.kind == sink->kind
+             && t->sink.stream == sink->stream
+             && t->sink.buffer == sink->buffer );
+    }
+}
+
+void
+_cprintf( struct ctable *t, const struct sink *sink, const char *fmt, struct arguments *args ){
+    struct cell *cell;
+    const struct format *f;
+    size_t i;
+    bool numeric = false;
+    uint64_t start = 0;
+    /* There's a reasonable argument that newlines should be indicated by
+       '\n' in the ordinary text, which would allow successive calls to 
+       cprintf() to populate a single line.  This raises, however, the
+       question of what to do with cprintf("\n\n") and similar.  For now,
+       keep parsing easy:  each call is one row.
+    */
+
+    use_sink( t, sink );
+
+    if( t->timing ){
+        start = now_ns();
+    }
+    f = lookup_format( t, fmt );
+    if( t->timing ){
+        t->stats.parse_ns += now_ns() - start;
+        start = now_ns();
+    }
+    if( t->nrows == t->row_capacity ){
+        t->row_capacity = t->row_capacity ? t->row_capacity * 2 : 1024;
+        t->row_lengths = realloc( t->row_lengths, t->row_capacity * sizeof( uint32_t ) );
+        assert( t->row_lengths );
+        t->stats.allocations++;
+    }
+    t->row_lengths[ t->nrows++ ] = f->npieces;
+
+    for( i = 0; i < f->npieces; i++ ){
+        cell = append_cell( t, i, &(f->pieces[i]) );
+        if( cell->piece->is_conversion_specification ){
+            calc_actual_width( &t->arena, cell, args );
+            // Keep a running maximum so cflush() needn't rescan.
+            // Once a stream has started, its widths only change in
+            // stream_row().
+            if( cell->width > t->columns[i].width && !t->streaming.started ){
+                t->columns[i].width = cell->width;
+            }
+            if( t->sticky ){
+                learn_width( t, f, i, cell->width );
+            }
+            if( t->footer.aggregates && !t->footer.appending ){
+                numeric = accumulate( t, i, cell ) || numeric;
+            }
+            t->stats.cells++;
+        }
+    }
+    if( numeric ){
+        t->footer.pieces = f->pieces;
+        t->footer.npieces = f->npieces;
+    }
+    assert( NULL != args->list || args->next == args->count );      // too many arguments
+    t->stats.rows++;
+    if( t->timing ){
+        t->stats.measure_ns += now_ns() - start;
+    }
+
+    if( t->streaming.enabled ){
+        stream_row( t );
+    }else if( t->sort.top > 0 && !t->footer.appending ){
+        select_row( t );
+    }else if( t->spill.threshold > 0 && table_bytes( t ) > t->spill.threshold ){
+        spill_rows( t );
+    }
+}
+
+static struct cell *
+append_cells( struct ctable *t, size_t column, size_t n ){
+    // Room for n more cells at the end of a column.
+    struct column *col;
+    size_t capacity;
+
+    if( column >= t->column_capacity ){
+        capacity = t->column_capacity ? t->column_capacity * 2 : 16;
+        while( capacity <= column ){
+            capacity *= 2;
+        }
+        t->columns = realloc( t->columns, capacity * sizeof( struct column ) );
+        assert( t->columns );
+        t->stats.allocations++;
+        memset( t->columns + t->column_capacity, 0, ( capacity - t->column_capacity ) * sizeof( struct column ) );
+        t->column_capacity = capacity;
+    }
+    if( column >= t->ncolumns ){
+        t->ncolumns = column + 1;
+    }
+
+    col = &(t->columns[ column ]);
+    if( col->ncells + n > col->capacity ){
+        capacity = col->capacity ? col->capacity * 2 : 64;
+        while( capacity < col->ncells + n ){
+            capacity *= 2;
+        }
+        col->cells = realloc( col->cells, capacity * sizeof( struct cell ) );
+        assert( col->cells );
+        t->stats.allocations++;
+        col->capacity = capacity;
+    }
+    col->ncells += n;
+    return col->cells + col->ncells - n;
+}
+
+static size_t
+measure_integers( struct cell *cells, size_t n, const struct extremes *e ){
+    // The widest of a column of integers.  A length only grows with
+    // the magnitude, so only the largest magnitude of each sign needs
+    // measuring.  The cells keep no length of their own; emit_integer()
+    // measures each value again as it prints it.
+    const struct piece *piece = cells[0].piece;
+    uintmax_t v, positive = 0, negative = 0;
+    bool minus;
+    struct integer digits;
+    size_t r, width = piece->minimum_width, length;
+
+    if( e->found ){
+        positive = e->highest;
+        negative = e->lowest < 0 ? (uintmax_t)0 - (uintmax_t)e->lowest : 0;
+    }else{
+        for( r = 0; r < n; r++ ){
+            cells[r].text = NULL;
+            cells[r].length = cells[r].width = 0;
+            v = integer_magnitude( piece, &(cells[r].val), &minus );
+            if( minus ){
+                negative = v > negative ? v : negative;
+            }else{
+                positive = v > positive ? v : positive;
+            }
+        }
+    }
+    if( ( length = measure_magnitude( piece, positive, false, &digits ) ) > width ){
+        width = length;
+    }
+    if( negative > 0 && ( length = measure_magnitude( piece, negative, true, &digits ) ) > width ){
+        width = length;
+    }
+    return width;
+}
+
+#define BULK_ROWS ((size_t)4096)
+
+static void
+append_columns( struct ctable *t, const struct sink *sink, const char *fmt, size_t nrows,
+                const cprintf_column_t *columns, size_t ncolumns ){
+    // A batch of rows at a time, and within a batch a column at a time,
+    // so each column is loaded and measured by a loop of its own.
+    // Streaming and shared tables, and tables picking their top rows,
+    // take the rows one by one.
+    struct arguments a = { NULL, NULL, ncolumns, 0, columns, 0 };
+    const struct format *f;
+    const struct piece *piece;
+    struct cell *cells;
+    struct extremes e;
+    size_t first, n, i, k, r, width;
+    uint64_t start = 0;
+
+    if( t->streaming.enabled || NULL != t->shared || t->sort.top > 0 ){
+        for( r = 0; r < nrows; r++ ){
+            a.row = r;
+            a.next = 0;
+            if( NULL != t->shared ){
+                publish_row( t, 0, fmt, &a );
+            }else{
+                _cprintf( t, sink, fmt, &a );
+            }
+        }
+        return;
+    }
+
+    use_sink( t, sink );
+    if( t->timing ){
+        start = now_ns();
+    }
+    f = lookup_format( t, fmt );
+    if( t->timing ){
+        t->stats.parse_ns += now_ns() - start;
+    }
+    for( i = 0, k = 0; i < f->npieces; i++ ){
+        k += f->pieces[i].is_conversion_specification;
+    }
+    assert( k == ncolumns );    // one column per conversion
+
+    for( first = 0; first < nrows; first += n ){
+        n = nrows - first < BULK_ROWS ? nrows - first : BULK_ROWS;
+        if( t->timing ){
+            start = now_ns();
+        }
+        if( t->nrows + n > t->row_capacity ){
+            while( t->nrows + n > t->row_capacity ){
+                t->row_capacity = t->row_capacity ? t->row_capacity * 2 : 1024;
+            }
+            t->row_lengths = realloc( t->row_lengths, t->row_capacity * sizeof( uint32_t ) );
+            assert( t->row_lengths );
+            t->stats.allocations++;
+        }
+        for( r = 0; r < n; r++ ){
+            t->row_lengths[ t->nrows + r ] = f->npieces;
+        }
+        t->nrows += n;
+
+        for( i = 0, k = 0; i < f->npieces; i++ ){
+            piece = &(f->pieces[i]);
+            cells = append_cells( t, i, n );
+            for( r = 0; r < n; r++ ){
+                cells[r].piece = piece;
+            }
+            if( !piece->is_conversion_specification ){
+                for( r = 0; r < n; r++ ){
+                    cells[r].text = piece->ordinary_text;
+                    cells[r].length = cells[r].width = piece->ordinary_length;
+                }
+                continue;
+            }
+            load_column( cells, n, columns[k].base, columns[k].stride * first, columns[k].stride, &e );
+            k++;
+            if( 0 != piece->base ){
+                width = measure_integers( cells, n, &e );
+            }else{
+                for( r = 0, width = 0; r < n; r++ ){
+                    render_text( &t->arena, &cells[r] );
+                    width = cells[r].width > width ? cells[r].width : width;
+                }
+            }
+            if( width > t->columns[i].width ){
+                t->columns[i].width = width;
+            }
+            if( t->sticky ){
+                learn_width( t, f, i, width );
+            }
+            if( t->footer.aggregates ){
+                for( r = 0; r < n; r++ ){
+                    accumulate( t, i, &cells[r] );
+                }
+                t->footer.pieces = f->pieces;
+                t->footer.npieces = f->npieces;
+            }
+        }
+        t->stats.rows += n;
+        t->stats.cells += n * ncolumns;
+        if( t->timing ){
+            t->stats.measure_ns += now_ns() - start;
+        }
+        if( t->spill.threshold > 0 && table_bytes( t ) > t->spill.threshold ){
+            spill_rows( t );
+        }
+    }
+}
+
+static void
+publish_row( struct ctable *t, int64_t key, const char *fmt, struct arguments *args ){
+    // Producer side of a shared table.  Safe to call from any number
+    // of threads at once.
+    struct arena *scratch = &get_default_table()->scratch;
+    const struct format *f;
+    struct cell *cells;
+    struct shared_row *row;
+    struct piece *pieces = NULL;
+    size_t i, bytes = 0, piece_bytes = 0;
+    char *text;
+
+    arena_reset( scratch );
+    f = lookup_format( t, fmt );
+    assert( f->npieces <= SHARED_MAX_COLUMNS );
+    if( f->uncached ){
+        piece_bytes = pieces_size( f->pieces, f->npieces );
+    }
+    cells = arena_alloc( scratch, f->npieces * sizeof( struct cell ) );
+    for( i = 0; i < f->npieces; i++ ){
+        cells[i].piece = &(f->pieces[i]);
+        if( cells[i].piece->is_conversion_specification ){
+            calc_actual_width( scratch, &(cells[i]), args );
+            if( NULL != cells[i].text ){
+                bytes += cells[i].length;
+            }
+        }else{
+            cells[i].text = cells[i].piece->ordinary_text;
+            cells[i].length = cells[i].width = cells[i].piece->ordinary_length;
+        }
+    }
+    assert( NULL != args->list || args->next == args->count );      // too many arguments
+
+    // One allocation per row, not per cell.  An uncached format's
+    // pieces go in it too, between the cells and the text.
+    row = malloc( sizeof( struct shared_row ) + f->npieces * sizeof( struct cell ) + piece_bytes + bytes );
+    assert( row );
+    row->key = key;
+    row->length = f->npieces;
+    text = (char *)&(row->cells[ f->npieces ]);
+    if( f->uncached ){
+        pieces = flatten_pieces( text, f->pieces, f->npieces );
+        text += piece_bytes;
+    }
+    for( i = 0; i < f->npieces; i++ ){
+        row->cells[i] = cells[i];
+        if( NULL != pieces ){
+            row->cells[i].piece = &(pieces[i]);
+            if( !pieces[i].is_conversion_specification ){
+                row->cells[i].text = pieces[i].ordinary_text;
+            }
+        }
+        if( cells[i].piece->is_conversion_specification && NULL != cells[i].text ){
+            memcpy( text, cells[i].text, cells[i].length );
+            row->cells[i].text = text;
+            text += cells[i].length;
+        }
+    }
+
+    row->sequence = atomic_fetch_add_explicit( &t->shared->sequence, 1, memory_order_relaxed );
+    row->next = atomic_load_explicit( &t->shared->head, memory_order_relaxed );
+    while( !atomic_compare_exchange_weak_explicit( &t->shared->head, &row->next, row,
+                                                   memory_order_release, memory_order_relaxed ) ){
+        // row->next was updated to the new head; try again.
+    }
+}
+
+static int
+compare_sequence( const void *a, const void *b ){
+    const struct shared_row *x = *(struct shared_row * const *)a;
+    const struct shared_row *y = *(struct shared_row * const *)b;
+    return ( x->sequence > y->sequence ) - ( x->sequence < y->sequence );
+}
+
+static int
+compare_key( const void *a, const void *b ){
+    const struct shared_row *x = *(struct shared_row * const *)a;
+    const struct shared_row *y = *(struct shared_row * const *)b;
+    if( x->key != y->key ){
+        return ( x->key > y->key ) - ( x->key < y->key );
+    }
+    return compare_sequence( a, b );
+}
+
+static size_t
+drain_shared_rows( struct ctable *t ){
+    // Consumer side:  moves every published row into the column
+    // storage, in order.  Returns the number of rows drained; the
+    // caller frees them with free_shared_rows() after printing.
+    struct shared *sh = t->shared;
+    struct shared_row *row = atomic_exchange_explicit( &sh->head, NULL, memory_order_acquire );
+    size_t n = 0, r, c;
+    struct cell *cell;
+
+    for( ; NULL != row; row = row->next ){
+        if( n == sh->sorted_capacity ){
+            sh->sorted_capacity = sh->sorted_capacity ? sh->sorted_capacity * 2 : 1024;
+            sh->sorted = realloc( sh->sorted, sh->sorted_capacity * sizeof( struct shared_row * ) );
+            assert( sh->sorted );
+            t->stats.allocations++;
+        }
+        sh->sorted[ n++ ] = row;
+    }
+    if( n > 1 ){
+        qsort( sh->sorted, n, sizeof( struct shared_row * ),
+                CPRINTF_ORDER_KEY == sh->order ? compare_key : compare_sequence );
+    }
+
+    for( r = 0; r < n; r++ ){
+        row = sh->sorted[r];
+        if( t->nrows == t->row_capacity ){
+            t->row_capacity = t->row_capacity ? t->row_capacity * 2 : 1024;
+            t->row_lengths = realloc( t->row_lengths, t->row_capacity * sizeof( uint32_t ) );
+            assert( t->row_lengths );
+            t->stats.allocations++;
+        }
+        t->row_lengths[ t->nrows++ ] = row->length;
+        for( c = 0; c < row->length; c++ ){
+            cell = append_cell( t, c, row->cells[c].piece );
+            *cell = row->cells[c];
+            if( cell->piece->is_conversion_specification ){
+                // Measured here rather than as rows are published, so
+                // the widths always describe exactly the rows drained.
+                if( cell->width > t->columns[c].width ){
+                    t->columns[c].width = cell->width;
+                }
+                if( t->footer.aggregates && accumulate( t, c, cell ) ){
+                    // A row's pieces are its format's, in order.
+                    t->footer.pieces = row->cells[0].piece;
+                    t->footer.npieces = row->length;
+                }
+                t->stats.cells++;
+            }
+        }
+    }
+    // Each row was malloc()ed by the thread that appended it.
+    t->stats.rows += n;
+    t->stats.allocations += n;
+    return n;
+}
+
+static void
+free_shared_rows( struct ctable *t, size_t n ){
+    size_t r;
+    for( r = 0; r < n; r++ ){
+        free( t->shared->sorted[r] );
+    }
+}
+
+static void
+destroy_default_table( void *t ){
+    // Runs at thread exit, so rows captured by a thread that never
+    // called cflush() are still printed.
+    ctdestroy( t );
+}
+
+static void
+create_default_table_key( void ){
+    int rc = pthread_key_create( &default_table_key, destroy_default_table );
+    assert( 0 == rc );
+    (void)rc;
+}
+
+static struct ctable *
+get_default_table( void ){
+    // The cprintf() family writes to a per-thread table whose stream is
+    // chosen by the first row after each flush.
+    if( NULL == default_table ){
+        pthread_once( &default_table_once, create_default_table_key );
+        struct sink none = { SINK_NONE, NULL, -1, NULL, 0, 0, NULL, NULL };
+        default_table = create_table( &none );
+        pthread_setspecific( default_table_key, default_table );
+    }
+    return default_table;
+}
+
+static struct ctable *
+create_table( const struct sink *sink ){
+    struct ctable *t = calloc( 1, sizeof( struct ctable ) );
+    size_t i;
+    assert( t );
+    // recall the value of NULL is implementation-specific.
+    t->sink = *sink;
+    for( i = 0; i < OUTPUT_CHUNKS; i++ ){
+        t->out.chunks[i].iov_base = NULL;
+    }
+    t->columns = NULL;
+    t->row_lengths = NULL;
+    t->arena.first = t->arena.current = NULL;
+    t->format_arena.first = t->format_arena.current = NULL;
+    t->uncached_format_arena.first = t->uncached_format_arena.current = NULL;
+    for( i = 0; i < FORMAT_CACHE_BUCKETS; i++ ){
+        t->format_cache[i] = NULL;
+    }
+    t->streaming.min_widths = NULL;
+    t->streaming.header = NULL;
+    t->streaming.overflow = CPRINTF_WIDEN;
+    t->streaming.arena.first = t->streaming.arena.current = NULL;
+    t->spill.directory = NULL;
+    t->spill.fd = -1;
+    t->spill.buf = NULL;
+    t->spill.failed = false;
+    t->shared = NULL;
+    t->scratch.first = t->scratch.current = NULL;
+    t->hook = NULL;
+    t->hook_context = NULL;
+    t->async.owner = t->async.next = t->async.spares = NULL;
+    t->parallel.nthreads = 1;
+    t->parallel.workers = NULL;
+    t->parallel.chunks = NULL;
+    t->parallel.threads = NULL;
+    t->parallel.cursors = NULL;
+    t->stats.allocations = 1;
+    if( NULL != getenv( "CPRINTF_STATS" ) ){
+        t->dump_stats = t->timing = true;
+    }
+    return t;
+}
+
+static struct sink
+file_sink( FILE *stream ){
+    struct sink sink = { SINK_FILE, stream, -1, NULL, 0, 0, NULL, NULL };
+    return sink;
+}
+
+static struct sink
+buffer_sink( char *buffer, size_t size ){
+    struct sink sink = { SINK_BUFFER, NULL, -1, buffer, size, 0, NULL, NULL };
+    if( size > 0 ){
+        buffer[0] = '\0';
+    }
+    return sink;
+}
+
+ctable_t *
+ctcreate( FILE *stream ){
+    struct sink sink = file_sink( stream );
+    return create_table( &sink );
+}
+
+ctable_t *
+ctcreate_fd( int fd ){
+    struct sink sink = { SINK_FD, NULL, fd, NULL, 0, 0, NULL, NULL };
+    return create_table( &sink );
+}
+
+ctable_t *
+ctcreate_buffer( char *buffer, size_t size ){
+    struct sink sink = buffer_sink( buffer, size );
+    return create_table( &sink );
+}
+
+ctable_t *
+ctcreate_string( void ){
+    struct sink sink = { SINK_STRING, NULL, -1, NULL, 0, 0, NULL, NULL };
+    return create_table( &sink );
+}
+
+ctable_t *
+ctcreate_callback( cprintf_write_fn write, void *context ){
+    struct sink sink = { SINK_CALLBACK, NULL, -1, NULL, 0, 0, write, context };
+    return create_table( &sink );
+}
+
+size_t
+ctlength( ctable_t *t ){
+    return t->sink.length;
+}
+
+int
+cterror( ctable_t *t ){
+    int error;
+    ctflush_wait( t );
+    error = t->error;
+    t->error = 0;
+    return error;
+}
+
+int
+cerror( void ){
+    return cterror( get_default_table() );
+}
+
+char *
+ctstring( ctable_t *t ){
+    // Hands the caller everything written so far; the table starts a
+    // new string.
+    char *s = t->sink.buffer;
+    assert( SINK_STRING == t->sink.kind );
+    if( NULL == s ){
+        s = calloc( 1, 1 );
+        assert( s );
+    }
+    t->sink.buffer = NULL;
+    t->sink.size = t->sink.length = 0;
+    return s;
+}
+
+ctable_t *
+ctcreate_shared( FILE *stream, cprintf_order_t order ){
+    struct sink sink = file_sink( stream );
+    struct ctable *t = create_table( &sink );
+    t->shared = calloc( 1, sizeof( struct shared ) );
+    assert( t->shared );
+    t->stats.allocations++;
+    t->shared->order = order;
+    atomic_init( &t->shared->head, NULL );
+    atomic_init( &t->shared->sequence, 0 );
+    pthread_mutex_init( &t->shared->format_lock, NULL );
+    t->shared->sorted = NULL;
+    return t;
+}
+
+void
+ctdestroy( ctable_t *t ){
+    struct ctable *d;
+    size_t c;
+    if( NULL == t ){
+        return;
+    }
+    ctflush( t );
+    for( c = 0; c < t->parallel.nworkers; c++ ){
+        ctdestroy( t->parallel.workers[c] );
+    }
+    free( t->parallel.workers );
+    free( t->parallel.chunks );
+    free( t->parallel.threads );
+    free( t->parallel.cursors );
+    ctdestroy( t->live.frame );
+    for( c = 0; c < 2; c++ ){
+        free( t->live.frames[c].text );
+        free( t->live.frames[c].starts );
+        free( t->live.frames[c].widths );
+    }
+    while( NULL != t->async.spares ){
+        d = t->async.spares;
+        t->async.spares = d->async.next;
+        ctdestroy( d );
+    }
+    for( c = 0; c < t->column_capacity; c++ ){
+        free( t->columns[c].cells );
+    }
+    free( t->columns );
+    free( t->row_lengths );
+    arena_free( &t->arena );
+    arena_free( &t->format_arena );
+    arena_free( &t->uncached_format_arena );
+    arena_free( &t->streaming.arena );
+    free( t->streaming.min_widths );
+    free( t->spill.directory );
+    free( t->spill.buf );
+    arena_free( &t->scratch );
+    arena_free( &t->profile.arena );
+    free( t->sort.keys );
+    free( t->sort.rows );
+    free( t->sort.values );
+    free( t->sort.at );
+    free( t->sort.heap );
+    free( t->sort.scratch );
+    arena_free( &t->sort.arena );
+    arena_free( &t->footer.arena );
+    free( t->footer.columns );
+    free( t->footer.fmt );
+    free( t->footer.args );
+    for( c = 0; c < OUTPUT_CHUNKS; c++ ){
+        free( t->out.chunks[c].iov_base );
+    }
+    if( SINK_STRING == t->sink.kind ){
+        free( t->sink.buffer );
+    }
+    if( NULL != t->shared ){
+        pthread_mutex_destroy( &t->shared->format_lock );
+        free( t->shared->sorted );
+        free( t->shared );
+    }
+    if( t == default_table ){
+        default_table = NULL;
+    }
+    free( t );
+}
+
+void
+ctprintf( ctable_t *t, const char *fmt, ... ){
+    va_list args;
+    struct arguments a = { &args, NULL, 0, 0, NULL, 0 };
+    va_start( args, fmt );
+    if( NULL != t->shared ){
+        publish_row( t, 0, fmt, &a );
+    }else{
+        _cprintf( t, NULL, fmt, &a );
+    }
+    va_end(args);
+}
+
+void
+ctvprintf( ctable_t *t, const char *fmt, va_list args ){
+    va_list args2;
+    struct arguments a = { &args2, NULL, 0, 0, NULL, 0 };
+    va_copy( args2, args );
+    if( NULL != t->shared ){
+        publish_row( t, 0, fmt, &a );
+    }else{
+        _cprintf( t, NULL, fmt, &a );
+    }
+    va_end(args2);
+}
+
+void
+ctkprintf( ctable_t *t, int64_t key, const char *fmt, ... ){
+    va_list args;
+    struct arguments a = { &args, NULL, 0, 0, NULL, 0 };
+    va_start( args, fmt );
+    if( NULL != t->shared ){
+        publish_row( t, key, fmt, &a );
+    }else{
+        _cprintf( t, NULL, fmt, &a );
+    }
+    va_end(args);
+}
+
+void
+ctprintf_args( ctable_t *t, const char *fmt, const cprintf_arg_t *args, size_t nargs ){
+    struct arguments a = { NULL, args, nargs, 0, NULL, 0 };
+    if( NULL != t->shared ){
+        publish_row( t, 0, fmt, &a );
+    }else{
+        _cprintf( t, NULL, fmt, &a );
+    }
+}
+
+void
+cprintf_args( const char *fmt, const cprintf_arg_t *args, size_t nargs ){
+    struct sink sink = file_sink( stdout );
+    struct arguments a = { NULL, args, nargs, 0, NULL, 0 };
+    _cprintf( get_default_table(), &sink, fmt, &a );
+}
+
+void
+ctprintf_columns( ctable_t *t, const char *fmt, size_t nrows, const cprintf_column_t *columns, size_t ncolumns ){
+    append_columns( t, NULL, fmt, nrows, columns, ncolumns );
+}
+
+void
+cprintf_columns( const char *fmt, size_t nrows, const cprintf_column_t *columns, size_t ncolumns ){
+    struct sink sink = file_sink( stdout );
+    append_columns( get_default_table(), &sink, fmt, nrows, columns, ncolumns );
+}
+
+void
+cprintf( const char *fmt, ... ){
+    struct sink sink = file_sink( stdout );
+    va_list args;
+    struct arguments a = { &args, NULL, 0, 0, NULL, 0 };
+    va_start( args, fmt );
+    _cprintf( get_default_table(), &sink, fmt, &a );
+    va_end(args);
+}
+
+void
+cfprintf( FILE *stream, const char *fmt, ... ){
+    struct sink sink = file_sink( stream );
+    va_list args;
+    struct arguments a = { &args, NULL, 0, 0, NULL, 0 };
+    va_start( args, fmt );
+    _cprintf( get_default_table(), &sink, fmt, &a );
+    va_end(args);
+
+}
+
+void
+csnprintf( char *str, size_t size, const char *fmt, ... ){
+    struct sink sink = buffer_sink( str, size );
+    va_list args;
+    struct arguments a = { &args, NULL, 0, 0, NULL, 0 };
+    va_start( args, fmt );
+    _cprintf( get_default_table(), &sink, fmt, &a );
+    va_end(args);
+}
+
+
+void
 cvprintf( const char *fmt, va_list args ){
+    struct sink sink = file_sink( stdout );
     va_list args2;
+    struct arguments a = { &args2, NULL, 0, 0, NULL, 0 };
     va_copy( args2, args );
-    _cprintf( stdout, fmt, &args2 );
+    _cprintf( get_default_table(), &sink, fmt, &a );
     va_end(args2);
 }
 
 void
 cvfprintf( FILE *stream, const char *fmt, va_list args ){
+    struct sink sink = file_sink( stream );
+    va_list args2;
+    struct arguments a = { &args2, NULL, 0, 0, NULL, 0 };
+    va_copy( args2, args );
+    _cprintf( get_default_table(), &sink, fmt, &a );
+    va_end(args2);
+}
+
+void
+cvsnprintf( char *str, size_t size, const char *fmt, va_list args ){
+    struct sink sink = buffer_sink( str, size );
     va_list args2;
+    struct arguments a = { &args2, NULL, 0, 0, NULL, 0 };
     va_copy( args2, args );
-    _cprintf( stream, fmt, &args2 );
+    _cprintf( get_default_table(), &sink, fmt, &a );
     va_end(args2);
 }
 
 
+void
+ctstream( ctable_t *t, size_t warmup_rows, const size_t *min_widths, size_t nwidths, cprintf_overflow_t overflow ){
+    // Anything already captured belongs to the previous table.
+    ctflush( t );
+    free( t->streaming.min_widths );
+    t->streaming.min_widths = NULL;
+    t->streaming.nwidths = 0;
+    if( nwidths > 0 ){
+        t->streaming.min_widths = malloc( nwidths * sizeof( size_t ) );
+        assert( t->streaming.min_widths );
+        t->stats.allocations++;
+        memcpy( t->streaming.min_widths, min_widths, nwidths * sizeof( size_t ) );
+        t->streaming.nwidths = nwidths;
+    }
+    t->streaming.warmup_rows = warmup_rows;
+    t->streaming.overflow = overflow;
+    t->streaming.enabled = true;
+}
+
+void
+ctbuffer( ctable_t *t ){
+    ctflush( t );
+    free( t->streaming.min_widths );
+    t->streaming.min_widths = NULL;
+    t->streaming.nwidths = 0;
+    t->streaming.enabled = false;
+}
+
+void
+ctspill( ctable_t *t, size_t threshold, const char *directory ){
+    ctflush( t );
+    free( t->spill.directory );
+    t->spill.directory = directory ? strdup( directory ) : NULL;
+    t->stats.allocations += NULL != directory;
+    t->spill.threshold = threshold;
+    if( threshold > 0 && NULL == t->spill.buf ){
+        t->spill.capacity = (size_t)1024 * 1024;
+        t->spill.buf = malloc( t->spill.capacity );
+        assert( t->spill.buf );
+        t->stats.allocations++;
+    }
+}
+
+void
+ctsort( ctable_t *t, const cprintf_sort_key_t *keys, size_t nkeys, size_t top ){
+    // Anything already captured is printed in the old order.
+    struct sort *s = &t->sort;
+    assert( nkeys <= SORT_MAX_KEYS );
+    assert( nkeys > 0 || 0 == top );    // top rows by what?
+    ctflush( t );
+    free( s->keys );
+    free( s->rows );
+    free( s->values );
+    s->keys = NULL;
+    s->rows = NULL;
+    s->values = NULL;
+    s->capacity = 0;
+    if( nkeys > 0 ){
+        s->keys = malloc( nkeys * sizeof( cprintf_sort_key_t ) );
+        assert( s->keys );
+        t->stats.allocations++;
+        memcpy( s->keys, keys, nkeys * sizeof( cprintf_sort_key_t ) );
+    }
+    s->nkeys = nkeys;
+    s->top = top;
+}
+
+void
+ctfooter( ctable_t *t, int aggregates ){
+    // Rows already captured are printed with the old footers.
+    ctflush( t );
+    t->footer.aggregates = aggregates;
+}
+
+void
+ctsticky( ctable_t *t, int on ){
+    t->sticky = on;
+}
+
+static struct profile_entry *
+profile_entry( struct ctable *t, const char *fmt, size_t length, size_t nwidths ){
+    // The entry for fmt, with room for at least nwidths widths, made
+    // if there isn't one yet.
+    struct profile_entry *e;
+    uint32_t *widths;
+    for( e = t->profile.entries; NULL != e; e = e->next ){
+        if( strlen( e->fmt ) == length && 0 == memcmp( e->fmt, fmt, length ) ){
+            break;
+        }
+    }
+    if( NULL == e ){
+        e = arena_alloc( &t->profile.arena, sizeof( struct profile_entry ) );
+        archive( &t->profile.arena, fmt, length, &(e->fmt) );
+        e->next = t->profile.entries;
+        t->profile.entries = e;
+    }
+    if( NULL == e->widths || e->nwidths < nwidths ){
+        widths = arena_alloc( &t->profile.arena, nwidths * sizeof( uint32_t ) + 1 );
+        if( e->nwidths > 0 ){
+            memcpy( widths, e->widths, e->nwidths * sizeof( uint32_t ) );
+        }
+        e->widths = widths;
+        e->nwidths = nwidths;
+    }
+    return e;
+}
+
+static size_t
+read_widths( const char *p, const char *end, uint32_t *widths ){
+    // Reads the widths in [p, end), which are decimal numbers each
+    // followed by one space, bar the last.  Returns how many there
+    // are, or SIZE_MAX if that's not what's there, raising widths[] to
+    // match unless it's NULL.
+    size_t n = 0;
+    unsigned long w;
+    char *q;
+    while( p < end ){
+        if( *p < '0' || *p > '9' ){
+            return SIZE_MAX;
+        }
+        errno = 0;
+        w = strtoul( p, &q, 10 );
+        if( 0 != errno || w > UINT32_MAX || q > end ){
+            return SIZE_MAX;
+        }
+        if( q < end && ( ' ' != *q || q + 1 == end ) ){
+            return SIZE_MAX;
+        }
+        if( NULL != widths && w > widths[n] ){
+            widths[n] = w;
+        }
+        n++;
+        p = q < end ? q + 1 : q;
+    }
+    return n;
+}
+
+int
+ctload_widths( ctable_t *t, const char *path ){
+    // Each line is the widths of a format's conversions, a tab, and
+    // the format with \\, \n and \t escaped.  Lines starting with '#'
+    // are comments, and lines that don't have this shape are skipped.
+    // Widths only grow, so loading the same profile twice, or on top
+    // of learned widths, is harmless.
+    FILE *f = fopen( path, "r" );
+    char *line = NULL, *p, *q, *fmt;
+    size_t size = 0, nwidths, b;
+    struct profile_entry *e;
+    ssize_t n;
+
+    if( NULL == f ){
+        return -1;
+    }
+    while( ( n = getline( &line, &size, f ) ) > 0 ){
+        if( '#' == line[0] || NULL == ( fmt = strchr( line, '\t' ) ) ){
+            continue;
+        }
+        nwidths = read_widths( line, fmt, NULL );
+        if( SIZE_MAX == nwidths ){
+            continue;
+        }
+        // Unescape the format in place.
+        for( p = q = ++fmt; p < line + n && '\n' != *p; p++ ){
+            if( '\\' == *p && p + 1 < line + n ){
+                p++;
+                *p = 'n' == *p ? '\n' : 't' == *p ? '\t' : *p;
+            }
+            *q++ = *p;
+        }
+        e = profile_entry( t, fmt, q - fmt, nwidths );
+        read_widths( line, fmt - 1, e->widths );
+    }
+    free( line );
+    fclose( f );
+
+    // Formats compiled before the profile was read get it too.
+    for( b = 0; b < FORMAT_CACHE_BUCKETS; b++ ){
+        struct format *cached;
+        for( cached = t->format_cache[b]; NULL != cached; cached = cached->next ){
+            apply_profile( t, cached );
+        }
+    }
+    t->sticky = true;
+    return 0;
+}
+
+static void
+fold_widths( struct ctable *t ){
+    // Folds what every cached format has learned into the profile.
+    struct format *cached;
+    struct profile_entry *e;
+    size_t b, i, k, n;
+
+    for( b = 0; b < FORMAT_CACHE_BUCKETS; b++ ){
+        for( cached = t->format_cache[b]; NULL != cached; cached = cached->next ){
+            for( i = n = 0; i < cached->npieces; i++ ){
+                n += cached->pieces[i].is_conversion_specification;
+            }
+            e = profile_entry( t, cached->fmt, strlen( cached->fmt ), n );
+            for( i = k = 0; i < cached->npieces; i++ ){
+                if( cached->pieces[i].is_conversion_specification ){
+                    e->widths[k] = cached->widths[i] > e->widths[k] ? cached->widths[i] : e->widths[k];
+                    k++;
+                }
+            }
+        }
+    }
+}
+
+int
+ctsave_widths( ctable_t *t, const char *path ){
+    // Writes the whole profile, with what the cached formats have
+    // learned, to a temporary file that replaces path, so a reader
+    // never sees half a profile.
+    struct profile_entry *e;
+    size_t k, n;
+    char *tmp;
+    const char *c;
+    FILE *f;
+    int fd, rc = 0;
+
+    fold_widths( t );
+    n = strlen( path ) + sizeof( ".XXXXXX" );
+    tmp = malloc( n );
+    assert( tmp );
+    t->stats.allocations++;
+    snprintf( tmp, n, "%s.XXXXXX", path );
+    fd = mkstemp( tmp );
+    if( -1 == fd || NULL == ( f = fdopen( fd, "w" ) ) ){
+        if( -1 != fd ){
+            close( fd );
+            unlink( tmp );
+        }
+        free( tmp );
+        return -1;
+    }
+    fprintf( f, "# cprintf width profile:  widths, a tab, then the format\n" );
+    for( e = t->profile.entries; NULL != e; e = e->next ){
+        for( k = 0; k < e->nwidths; k++ ){
+            fprintf( f, k > 0 ? " %" PRIu32 : "%" PRIu32, e->widths[k] );
+        }
+        fputc( '\t', f );
+        for( c = e->fmt; '\0' != *c; c++ ){
+            switch( *c ){
+                case '\\':  fputs( "\\\\", f );   break;
+                case '\n':  fputs( "\\n", f );    break;
+                case '\t':  fputs( "\\t", f );    break;
+                default:    fputc( *c, f );     break;
+            }
+        }
+        fputc( '\n', f );
+    }
+    if( 0 != ferror( f ) ){
+        rc = -1;
+    }
+    if( 0 != fclose( f ) || 0 != rc || 0 != rename( tmp, path ) ){
+        unlink( tmp );
+        rc = -1;
+    }
+    free( tmp );
+    return rc;
+}
+
+static void
+add_stats( struct ctable *t, cprintf_stats_t *stats ){
+    size_t c, bytes;
+    int p;
+    stats->rows += t->stats.rows;
+    stats->cells += t->stats.cells;
+    stats->flushes += t->stats.flushes;
+    stats->bytes_written += t->stats.bytes_written;
+    stats->parse_ns += t->stats.parse_ns;
+    stats->measure_ns += t->stats.measure_ns;
+    for( p = 0; p < CPRINTF_PHASES; p++ ){
+        stats->phase_ns[p] += t->stats.phase_ns[p];
+    }
+
+    // Everything the table holds on to between flushes.
+    bytes = sizeof( struct ctable )
+          + t->arena.held + t->format_arena.held + t->uncached_format_arena.held
+          + t->streaming.arena.held + t->scratch.held + t->profile.arena.held + t->sort.arena.held
+          + t->footer.arena.held
+          + t->sort.capacity * ( sizeof( struct sort_row ) + t->sort.nkeys * sizeof( struct sort_value ) )
+          + t->sort.at_capacity * sizeof( size_t ) + t->sort.heap_capacity * sizeof( uint32_t )
+          + t->sort.scratch_capacity * sizeof( struct cell )
+          + t->footer.capacity * sizeof( struct aggregate ) + t->footer.size
+          + t->footer.nargs * sizeof( cprintf_arg_t )
+          + t->column_capacity * sizeof( struct column )
+          + t->row_capacity * sizeof( uint32_t )
+          + t->streaming.nwidths * sizeof( size_t );
+    for( c = 0; c < t->column_capacity; c++ ){
+        bytes += t->columns[c].capacity * sizeof( struct cell );
+    }
+    for( c = 0; c < OUTPUT_CHUNKS; c++ ){
+        bytes += NULL != t->out.chunks[c].iov_base ? OUTPUT_CHUNK_SIZE : 0;
+    }
+    if( NULL != t->spill.buf ){
+        bytes += t->spill.capacity;
+    }
+    if( NULL != t->shared ){
+        bytes += sizeof( struct shared ) + t->shared->sorted_capacity * sizeof( struct shared_row * );
+    }
+    stats->bytes_held += bytes;
+
+    stats->allocations += t->stats.allocations
+                        + t->arena.blocks + t->format_arena.blocks + t->uncached_format_arena.blocks
+                        + t->streaming.arena.blocks + t->scratch.blocks + t->profile.arena.blocks
+                        + t->sort.arena.blocks + t->footer.arena.blocks;
+}
+
+static struct{
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // something was queued
+    pthread_cond_t done;        // something was written
+    struct ctable *head, *tail;
+    bool busy;                  // writing a table taken off the queue
+}writer = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER, NULL, NULL, false };
+
+void
+ctstats( ctable_t *t, cprintf_stats_t *stats ){
+    // Detached tables count toward the table they serve once they've
+    // been written.  Parallel workers and live frames only add the
+    // memory they hold.
+    struct ctable *d;
+    cprintf_stats_t worker;
+    size_t k;
+    memset( stats, 0, sizeof( *stats ) );
+    add_stats( t, stats );
+    for( k = 0; k < t->parallel.nworkers; k++ ){
+        memset( &worker, 0, sizeof( worker ) );
+        add_stats( t->parallel.workers[k], &worker );
+        stats->bytes_held += worker.bytes_held + t->parallel.workers[k]->sink.size;
+        stats->allocations += worker.allocations;
+    }
+    if( NULL != t->live.frame ){
+        memset( &worker, 0, sizeof( worker ) );
+        add_stats( t->live.frame, &worker );
+        stats->bytes_held += worker.bytes_held + t->live.frame->sink.size;
+        stats->allocations += worker.allocations;
+        for( k = 0; k < 2; k++ ){
+            stats->bytes_held += t->live.frames[k].size + 2 * t->live.frames[k].capacity * sizeof( size_t );
+        }
+    }
+    if( t->detached ){
+        pthread_mutex_lock( &writer.lock );
+        for( d = t->async.spares; NULL != d; d = d->async.next ){
+            add_stats( d, stats );
+        }
+        pthread_mutex_unlock( &writer.lock );
+    }
+}
+
+void
+cprintf_stats( cprintf_stats_t *stats ){
+    ctstats( get_default_table(), stats );
+}
+
+void
+cttiming( ctable_t *t, int on ){
+    t->timing = on;
+}
+
+void
+cprintf_timing( int on ){
+    cttiming( get_default_table(), on );
+}
+
+void
+cthook( ctable_t *t, cprintf_hook_fn hook, void *context ){
+    t->hook = hook;
+    t->hook_context = context;
+}
+
+void
+cprintf_hook( cprintf_hook_fn hook, void *context ){
+    cthook( get_default_table(), hook, context );
+}
+
+static void
+dump_stats( struct ctable *t ){
+    // One line per flush, for $CPRINTF_STATS.
+    cprintf_stats_t s;
+    ctstats( t, &s );
+    fprintf( stderr, "cprintf: rows=%" PRIu64 " cells=%" PRIu64 " flushes=%" PRIu64
+            " bytes_held=%zu allocations=%" PRIu64 " bytes_written=%" PRIu64
+            " parse_ns=%" PRIu64 " measure_ns=%" PRIu64 " flush_ns=%" PRIu64
+            " gather_ns=%" PRIu64 " format_ns=%" PRIu64 " write_ns=%" PRIu64 "\n",
+            s.rows, s.cells, s.flushes, s.bytes_held, s.allocations, s.bytes_written,
+            s.parse_ns, s.measure_ns, s.phase_ns[ CPRINTF_PHASE_FLUSH ],
+            s.phase_ns[ CPRINTF_PHASE_GATHER ], s.phase_ns[ CPRINTF_PHASE_FORMAT ],
+            s.phase_ns[ CPRINTF_PHASE_WRITE ] );
+}
+
+static void *
+write_detached_tables( void *unused ){
+    // The writer thread:  flushes detached tables in the order they
+    // were queued, then returns each to the spares of its owner.
+    struct ctable *d;
+    (void)unused;
+    pthread_mutex_lock( &writer.lock );
+    for( ;; ){
+        while( NULL == writer.head ){
+            pthread_cond_wait( &writer.work, &writer.lock );
+        }
+        d = writer.head;
+        writer.head = d->async.next;
+        if( NULL == writer.head ){
+            writer.tail = NULL;
+        }
+        writer.busy = true;
+        d->error = d->async.owner->error;   // nothing more after a failure
+        pthread_mutex_unlock( &writer.lock );
+
+        ctflush( d );
+
+        pthread_mutex_lock( &writer.lock );
+        writer.busy = false;
+        d->async.owner->error = d->error;   // for cterror(), after ctflush_wait()
+        d->async.next = d->async.owner->async.spares;
+        d->async.owner->async.spares = d;
+        d->async.owner->async.pending--;
+        pthread_cond_broadcast( &writer.done );
+    }
+    return NULL;
+}
+
+static void
+drain_writer( void ){
+    // At exit, everything already handed to the writer still gets
+    // written before stdio is torn down.
+    pthread_mutex_lock( &writer.lock );
+    while( NULL != writer.head || writer.busy ){
+        pthread_cond_wait( &writer.done, &writer.lock );
+    }
+    pthread_mutex_unlock( &writer.lock );
+}
+
+static void
+start_writer( void ){
+    pthread_t thread;
+    pthread_attr_t attr;
+    int rc;
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    rc = pthread_create( &thread, &attr, write_detached_tables, NULL );
+    assert( 0 == rc );
+    (void)rc;
+    pthread_attr_destroy( &attr );
+    atexit( drain_writer );
+}
+
+static void
+swap_rows( struct ctable *t, struct ctable *d ){
+    // Everything captured since the last flush, and the format cache
+    // its cells point into, trades places with d's emptied storage.
+    // Sticky widths belong to the table rather than its rows, so they
+    // stay:  the columns get theirs back, and what the formats learned
+    // goes into the profile for the formats compiled next.
+    size_t i;
+    if( t->sticky ){
+        fold_widths( t );
+    }
+    SWAP( t->columns, d->columns );
+    SWAP( t->ncolumns, d->ncolumns );
+    SWAP( t->column_capacity, d->column_capacity );
+    SWAP( t->row_lengths, d->row_lengths );
+    SWAP( t->nrows, d->nrows );
+    SWAP( t->row_capacity, d->row_capacity );
+    SWAP( t->arena, d->arena );
+    SWAP( t->format_arena, d->format_arena );
+    SWAP( t->uncached_format_arena, d->uncached_format_arena );
+    for( i = 0; i < FORMAT_CACHE_BUCKETS; i++ ){
+        SWAP( t->format_cache[i], d->format_cache[i] );
+    }
+    SWAP( t->format_cache_entries, d->format_cache_entries );
+    SWAP( t->out, d->out );
+    if( t->sticky ){
+        if( t->column_capacity < d->ncolumns ){
+            t->columns = realloc( t->columns, d->ncolumns * sizeof( struct column ) );
+            assert( t->columns );
+            t->stats.allocations++;
+            memset( t->columns + t->column_capacity, 0, ( d->ncolumns - t->column_capacity ) * sizeof( struct column ) );
+            t->column_capacity = d->ncolumns;
+        }
+        for( i = 0; i < d->ncolumns; i++ ){
+            t->columns[i].width = d->columns[i].width;
+        }
+        t->ncolumns = d->ncolumns;
+    }
+    // The keys taken were those of the rows that just left.
+    t->sort.taken = t->sort.nheap = t->sort.ndead = t->sort.dropped = 0;
+    t->sort.have_pattern = false;
+}
+
+void
+ctflush_wait( ctable_t *t ){
+    if( !t->detached ){
+        return;
+    }
+    pthread_mutex_lock( &writer.lock );
+    while( t->async.pending > 0 ){
+        pthread_cond_wait( &writer.done, &writer.lock );
+    }
+    pthread_mutex_unlock( &writer.lock );
+}
+
+void
+cflush_wait( void ){
+    ctflush_wait( get_default_table() );
+}
+
+void
+ctflush_async( ctable_t *t ){
+    struct ctable *d;
+
+    if( t->streaming.enabled || NULL != t->shared || -1 != t->spill.fd || t->live.enabled
+     || SINK_BUFFER == t->sink.kind || SINK_STRING == t->sink.kind ){
+        // Output that's already under way or that lands in memory
+        // isn't worth a thread.
+        ctflush( t );
+        return;
+    }
+
+    pthread_once( &writer.once, start_writer );
+    pthread_mutex_lock( &writer.lock );
+    d = t->async.spares;
+    if( NULL != d ){
+        t->async.spares = d->async.next;
+    }
+    t->async.pending++;
+    pthread_mutex_unlock( &writer.lock );
+
+    if( NULL == d ){
+        d = create_table( &t->sink );
+        d->async.owner = t;
+        d->dump_stats = false;
+        t->detached = true;
+    }
+    if( t->sort.nkeys > 0 ){
+        sort_rows( t );
+    }
+    append_footers( t );
+    swap_rows( t, d );
+    d->sink = t->sink;
+    d->timing = t->timing;
+    d->hook = t->hook;
+    d->hook_context = t->hook_context;
+    d->parallel.nthreads = t->parallel.nthreads;
+    d->async.next = NULL;
+
+    pthread_mutex_lock( &writer.lock );
+    if( NULL == writer.tail ){
+        writer.head = d;
+    }else{
+        writer.tail->async.next = d;
+    }
+    writer.tail = d;
+    pthread_cond_signal( &writer.work );
+    pthread_mutex_unlock( &writer.lock );
+
+    if( t->dump_stats ){
+        dump_stats( t );
+    }
+}
+
+void
+cflush_async( void ){
+    struct ctable *t = get_default_table();
+    ctflush_async( t );
+    t->sink.kind = SINK_NONE;
+}
+
+void
+ctflush( ctable_t *t ){
+    // In streaming mode this prints any rows still held for warm-up.
+    size_t drained = 0;
+    ctflush_wait( t );      // earlier rows go first
+    phase( t, CPRINTF_PHASE_FLUSH, true );
+    if( NULL != t->shared ){
+        phase( t, CPRINTF_PHASE_GATHER, true );
+        drained = drain_shared_rows( t );
+        phase( t, CPRINTF_PHASE_GATHER, false );
+    }
+    phase( t, CPRINTF_PHASE_FORMAT, true );
+    if( t->sort.nkeys > 0 && !t->streaming.enabled ){
+        sort_rows( t );
+    }
+    append_footers( t );
+    if( CPRINTF_TEXT != t->form ){
+        export_rows( t, t->form );
+    }else if( t->live.enabled ){
+        draw_live_frame( t );
+    }else{
+        if( -1 != t->spill.fd ){
+            // Everything goes through the file so rows stay in order, but
+            // for any a failed write left in memory, which follow it.
+            spill_rows( t );
+            print_spilled_rows( t );
+            close( t->spill.fd );
+            t->spill.fd = -1;
+        }
+        print_something_already( t );
+    }
+    phase( t, CPRINTF_PHASE_FORMAT, false );
+    deliver( t );
+    reset_table( t );
+    if( drained > 0 ){
+        free_shared_rows( t, drained );
+    }
+    t->streaming.started = false;
+    t->streaming.header = NULL;
+    t->streaming.header_length = 0;
+    arena_reset( &t->streaming.arena );
+    t->stats.flushes++;
+    phase( t, CPRINTF_PHASE_FLUSH, false );
+    if( t->dump_stats ){
+        dump_stats( t );
+    }
+}
+
+void
+ctlive( ctable_t *t, int on ){
+    // Anything already captured belongs to the previous table, and the
+    // next frame is drawn in full.
+    ctflush( t );
+    t->live.enabled = on;
+    t->live.frames[0].drawn = t->live.frames[1].drawn = false;
+}
+
+void
+clive( int on ){
+    ctlive( get_default_table(), on );
+}
+
+void
+ctflush_as( ctable_t *t, cprintf_export_t form ){
+    t->form = form;
+    ctflush( t );
+    t->form = CPRINTF_TEXT;
+}
+
+void
+cflush_as( cprintf_export_t form ){
+    struct ctable *t = get_default_table();
+    ctflush_as( t, form );
+    t->sink.kind = SINK_NONE;
+}
+
+void
+cstream( size_t warmup_rows, const size_t *min_widths, size_t nwidths, cprintf_overflow_t overflow ){
+    ctstream( get_default_table(), warmup_rows, min_widths, nwidths, overflow );
+}
+
+void
+cbuffer( void ){
+    ctbuffer( get_default_table() );
+}
+
+void
+ctthreads( ctable_t *t, size_t nthreads ){
+    long online;
+    if( 0 == nthreads ){
+        online = sysconf( _SC_NPROCESSORS_ONLN );
+        nthreads = online > 0 ? online : 1;
+    }
+    t->parallel.nthreads = nthreads;
+}
+
+void
+cthreads( size_t nthreads ){
+    ctthreads( get_default_table(), nthreads );
+}
+
+void
+csort( const cprintf_sort_key_t *keys, size_t nkeys, size_t top ){
+    ctsort( get_default_table(), keys, nkeys, top );
+}
+
+void
+cfooter( int aggregates ){
+    ctfooter( get_default_table(), aggregates );
+}
+
+void
+csticky( int on ){
+    ctsticky( get_default_table(), on );
+}
+
+int
+cload_widths( const char *path ){
+    return ctload_widths( get_default_table(), path );
+}
+
+int
+csave_widths( const char *path ){
+    return ctsave_widths( get_default_table(), path );
+}
+
+void
+cspill( size_t threshold, const char *directory ){
+    ctspill( get_default_table(), threshold, directory );
+}
+
 void
 cflush(){ 
-    calc_max_width();
-    generate_new_specs();
-    print_something_already();
-    free_graph();
-    dest = NULL;
+    struct ctable *t = get_default_table();
+    ctflush( t );
+    t->sink.kind = SINK_NONE;
 }
@@ -0,0 +1,311 @@
+// Copyright 2022 Lawrence Livermore National Security, LLC and other
+// libjustify Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: MIT
+
+// Differential tests for `make check`.  The integer and floating point
+// kernels must print exactly what snprintf() does, for every conversion,
+// length modifier and combination of flags, across a spread of field
+// widths, precisions and values.  Each case is a table of one row, so
+// the width the kernels measure is the width they print.
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "cprintf.h"
+
+static char got[8192];      // %Lf of LDBL_MAX is nearly 5,000 bytes
+static size_t got_length;
+static ctable_t *table;
+static size_t cases, failures;
+
+static void
+collect( void *context, const char *data, size_t length ){
+    (void)context;
+    if( got_length + length < sizeof( got ) ){
+        memcpy( got + got_length, data, length );
+    }
+    got_length += length;
+}
+
+static void
+compare( const char *fmt, const char *want, const char *value ){
+    cases++;
+    if( got_length == strlen( want ) && 0 == memcmp( got, want, got_length ) ){
+        return;
+    }
+    if( failures++ < 20 ){
+        // Every format ends its row with a newline; leave it out.
+        printf( "# \"%.*s\" of %s:  snprintf() gives \"%.*s\", cprintf \"%.*s\"\n",
+                (int)strcspn( fmt, "\n" ), fmt, value, (int)strcspn( want, "\n" ), want,
+                (int)strcspn( got, "\n" ), got );
+    }
+}
+
+// Formats v with both and compares them.  v is converted to T first,
+// as va_arg() would see it.
+#define DIFFER( T, v, fmt, value )                                          \
+    do{                                                                     \
+        char want_[ sizeof( got ) ];                                        \
+        T v_ = (T)(v);                                                      \
+        snprintf( want_, sizeof( want_ ), fmt, v_ );                        \
+        got_length = 0;                                                     \
+        ctprintf( table, fmt, v_ );                                         \
+        ctflush( table );                                                   \
+        compare( fmt, want_, value );                                       \
+    }while( 0 )
+
+static uint64_t
+next_random( uint64_t *state ){
+    // xorshift64*; the same sequence every run.
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static size_t
+integer_values( unsigned long long *values ){
+    // Zero, the edges of every type, powers of 2 and 10 and their
+    // neighbours (where the digit counts change), and some at random.
+    static const unsigned long long edges[] = {
+        0, 1, 7, 8, 9, 15, 16, 17, 99, 127, 128, 255, 256, 32767, 32768, 65535, 65536,
+        INT_MAX, (unsigned long long)INT_MAX + 1, UINT_MAX, (unsigned long long)UINT_MAX + 1,
+        LLONG_MAX, (unsigned long long)LLONG_MAX + 1, ULLONG_MAX
+    };
+    unsigned long long p;
+    uint64_t state = 88172645463325252ull;
+    size_t n = 0, i;
+    for( i = 0; i < sizeof( edges ) / sizeof( edges[0] ); i++ ){
+        values[ n++ ] = edges[i];
+        values[ n++ ] = -edges[i];
+    }
+    for( i = 0, p = 10; i < 19; i++, p *= 10 ){
+        values[ n++ ] = p - 1;
+        values[ n++ ] = p;
+        values[ n++ ] = -p;
+    }
+    for( i = 0; i < 16; i++ ){
+        values[ n++ ] = next_random( &state ) >> ( i * 4 );
+    }
+    return n;
+}
+
+static void
+differ_integers( void ){
+    static const char *modifiers[] = { "hh", "h", "", "l", "ll", "j", "z", "t" };
+    static const char *widths[] = { "", "1", "12", "24" };
+    static const char *precisions[] = { "", ".0", ".5", ".21" };
+    static const char conversions[] = "douxX";      // %i is %d
+    static const char all_flags[] = "-+ #0";
+    unsigned long long values[ 128 ];
+    char fmt[64], flags[8], value[32];
+    size_t nvalues = integer_values( values ), m, w, p, c, v, k, n, j, first = 0;
+    unsigned bits;
+    bool is_signed;
+
+    for( c = 0; c < sizeof( conversions ) - 1; c++ ){
+        is_signed = 'd' == conversions[c] || 'i' == conversions[c];
+        for( bits = 0; bits < 32; bits++ ){
+            for( k = n = 0; k < 5; k++ ){
+                if( bits & ( 1u << k ) ){
+                    flags[ n++ ] = all_flags[k];
+                }
+            }
+            flags[n] = '\0';
+            if( is_signed && NULL != strchr( flags, '#' ) ){
+                continue;   // undefined
+            }
+            for( m = 0; m < sizeof( modifiers ) / sizeof( modifiers[0] ); m++ ){
+                for( w = 0; w < sizeof( widths ) / sizeof( widths[0] ); w++ ){
+                    for( p = 0; p < sizeof( precisions ) / sizeof( precisions[0] ); p++ ){
+                        snprintf( fmt, sizeof( fmt ), "%%%s%s%s%s%c\n",
+                                  flags, widths[w], precisions[p], modifiers[m], conversions[c] );
+                        // Each specification gets the next few values in
+                        // turn, so every value meets every conversion.
+                        for( j = 0; j < 20; j++ ){
+                            v = first++ % nvalues;
+                            snprintf( value, sizeof( value ), "%#llx", values[v] );
+                            switch( m ){
+                                case 0:
+                                case 1:
+                                case 2:
+                                    if( is_signed ){
+                                        DIFFER( int, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( unsigned int, values[v], fmt, value );
+                                    }
+                                    break;
+                                case 3:
+                                    if( is_signed ){
+                                        DIFFER( long, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( unsigned long, values[v], fmt, value );
+                                    }
+                                    break;
+                                case 4:
+                                    if( is_signed ){
+                                        DIFFER( long long, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( unsigned long long, values[v], fmt, value );
+                                    }
+                                    break;
+                                case 5:
+                                    if( is_signed ){
+                                        DIFFER( intmax_t, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( uintmax_t, values[v], fmt, value );
+                                    }
+                                    break;
+                                case 6:
+                                    if( is_signed ){
+                                        DIFFER( ssize_t, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( size_t, values[v], fmt, value );
+                                    }
+                                    break;
+                                case 7:
+                                    if( is_signed ){
+                                        DIFFER( ptrdiff_t, values[v], fmt, value );
+                                    }else{
+                                        DIFFER( size_t, values[v], fmt, value );
+                                    }
+                                    break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static size_t
+double_values( double *values ){
+    // Signed zeros, infinities and NaNs, the extremes (subnormals
+    // included), values that round up a digit or tie, and some random
+    // finite bit patterns.
+    static const double specials[] = {
+        0.0, 1.0, 0.5, 0.1, 1.0 / 3, 2.0 / 3, 0.125, 2.5, 9.5, 0.05, 123.456, 999.9999,
+        99999.5, 0x1.fffffffffffffp-1, 0.999999999, 9.999999999e-5, 1e-5, 1e-300, 1e15,
+        1e16, 1e22, 1e23, 9007199254740993.0, 5e-324, DBL_MIN, DBL_MIN / 3, DBL_MAX,
+        INFINITY, NAN
+    };
+    uint64_t state = 2463534242ull, bits;
+    size_t n = 0, i;
+    double x;
+    for( i = 0; i < sizeof( specials ) / sizeof( specials[0] ); i++ ){
+        values[ n++ ] = specials[i];
+        values[ n++ ] = -specials[i];
+    }
+    while( n < 96 ){
+        bits = next_random( &state );
+        memcpy( &x, &bits, sizeof( x ) );
+        if( isfinite( x ) ){
+            values[ n++ ] = x;
+        }
+    }
+    return n;
+}
+
+static size_t
+long_double_values( long double *values ){
+    // The doubles, and what only long double can hold.
+    static const long double specials[] = {
+        1.0L / 3, 0x1.fffffffffffffffep-1L, 0.1L, 1e4000L, 1e-4000L,
+        LDBL_MIN, LDBL_MIN / 3, LDBL_TRUE_MIN, LDBL_MAX
+    };
+    uint64_t state = 1181783497276652981ull;
+    double doubles[ 128 ];
+    size_t n = 0, i, ndoubles = double_values( doubles );
+    for( i = 0; i < ndoubles; i += 2 ){
+        values[ n++ ] = doubles[i];
+    }
+    for( i = 0; i < sizeof( specials ) / sizeof( specials[0] ); i++ ){
+        values[ n++ ] = specials[i];
+        values[ n++ ] = -specials[i];
+    }
+    for( i = 0; i < 32; i++ ){
+        values[ n++ ] = ldexpl( (long double)next_random( &state ), (int)( next_random( &state ) % 32000 ) - 16000 );
+    }
+    return n;
+}
+
+static void
+differ_floats( void ){
+    static const char *modifiers[] = { "", "l", "L" };
+    static const char *widths[] = { "", "1", "12", "40" };
+    static const char *precisions[] = { "", ".0", ".1", ".3", ".6", ".17", ".40" };
+    static const char conversions[] = "fFeEgGaA";
+    static const char all_flags[] = "-+ #0";
+    double doubles[ 128 ];
+    long double long_doubles[ 192 ];
+    char fmt[64], flags[8], value[64];
+    size_t ndoubles = double_values( doubles ), nlong_doubles = long_double_values( long_doubles );
+    size_t m, w, p, c, k, n, j, v, first = 0;
+    unsigned bits;
+
+    for( c = 0; c < sizeof( conversions ) - 1; c++ ){
+        for( bits = 0; bits < 32; bits++ ){
+            for( k = n = 0; k < 5; k++ ){
+                if( bits & ( 1u << k ) ){
+                    flags[ n++ ] = all_flags[k];
+                }
+            }
+            flags[n] = '\0';
+            for( m = 0; m < sizeof( modifiers ) / sizeof( modifiers[0] ); m++ ){
+                for( w = 0; w < sizeof( widths ) / sizeof( widths[0] ); w++ ){
+                    for( p = 0; p < sizeof( precisions ) / sizeof( precisions[0] ); p++ ){
+                        snprintf( fmt, sizeof( fmt ), "%%%s%s%s%s%c\n",
+                                  flags, widths[w], precisions[p], modifiers[m], conversions[c] );
+                        for( j = 0; j < 16; j++, first++ ){
+                            if( 2 == m ){
+                                v = first % nlong_doubles;
+                                snprintf( value, sizeof( value ), "%La", long_doubles[v] );
+                                DIFFER( long double, long_doubles[v], fmt, value );
+                            }else{
+                                v = first % ndoubles;
+                                snprintf( value, sizeof( value ), "%a", doubles[v] );
+                                DIFFER( double, doubles[v], fmt, value );
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void
+report( const char *name, size_t before ){
+    if( failures == before ){
+        printf( "ok %s\n", name );
+    }else{
+        printf( "FAIL %s: %zu cases differ\n", name, failures - before );
+    }
+}
+
+int
+main( void ){
+    size_t before;
+    table = ctcreate_callback( collect, NULL );
+
+    before = failures;
+    differ_integers();
+    report( "integers", before );
+
+    before = failures;
+    differ_floats();
+    report( "floating point", before );
+
+    ctdestroy( table );
+    printf( "# %zu cases\n", cases );
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
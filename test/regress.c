@@ -0,0 +1,914 @@
+// Copyright 2022 Lawrence Livermore National Security, LLC and other
+// libjustify Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: MIT
+
+// Regression tests for `make check`.  Each test prints "ok name" or
+// "FAIL name: why" and the run fails if any did.  Built with
+// AddressSanitizer, so memory errors abort.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "cprintf.h"
+
+static int failures;
+
+static void
+check( const char *name, int ok, const char *why ){
+    if( ok ){
+        printf( "ok %s\n", name );
+    }else{
+        printf( "FAIL %s: %s\n", name, why );
+        failures++;
+    }
+}
+
+static void
+read_back( FILE *f, char *text, size_t size ){
+    // Everything written to f, as a string.
+    size_t n;
+    fflush( f );
+    rewind( f );
+    n = fread( text, 1, size - 1, f );
+    text[n] = '\0';
+}
+
+static void
+stream_overflow( const char *name, cprintf_overflow_t overflow, const char *want ){
+    // One warm-up row sets the widths; the rows after it are wider.
+    FILE *f = tmpfile();
+    char text[256];
+    cstream( 1, NULL, 0, overflow );
+    cfprintf( f, "%s|%s\n", "name", "n" );
+    cfprintf( f, "%s|%d\n", "ab", 22 );
+    cfprintf( f, "%s|%d\n", "longer", 333 );
+    cfprintf( f, "%s|%d\n", "c", 4 );
+    cflush();
+    cbuffer();
+    read_back( f, text, sizeof( text ) );
+    fclose( f );
+    check( name, 0 == strcmp( text, want ), text );
+}
+
+static void
+streamed_rows_widen( void ){
+    stream_overflow( "streamed_rows_widen", CPRINTF_WIDEN,
+                     "name|n\n  ab|22\nlonger|333\n     c|  4\n" );
+}
+
+static void
+streamed_rows_truncate( void ){
+    stream_overflow( "streamed_rows_truncate", CPRINTF_TRUNCATE,
+                     "name|n\n  ab|2\nlong|3\n   c|4\n" );
+}
+
+static void
+streamed_rows_reheader( void ){
+    stream_overflow( "streamed_rows_reheader", CPRINTF_REHEADER,
+                     "name|n\nname| n\n  ab|22\n  name|  n\nlonger|333\n     c|  4\n" );
+}
+
+static void
+spilled_rows( FILE *f, size_t threshold ){
+    static const char *words[] = { "a", "bb", "ccc dd", "", "eeeeeeeeeeee" };
+    int r;
+    cspill( threshold, NULL );
+    for( r = 0; r < 5000; r++ ){
+        cfprintf( f, "%d %s|%8.3f %-6s|%c\n", r * 7919 % 100003, words[ r % 5 ],
+                  r / 7.0, words[ r * 3 % 5 ], 'a' + r % 26 );
+        if( r % 1000 == 999 ){
+            cfprintf( f, "%s\n", "a row of its own shape" );
+        }
+    }
+    cflush();
+    cspill( 0, NULL );
+}
+
+static void
+spilling_changes_nothing( void ){
+    // The same rows, kept in memory and spilled many times over.
+    FILE *kept = tmpfile(), *spilled = tmpfile();
+    size_t size = 1 << 20;
+    char *want = malloc( size ), *got = malloc( size );
+    spilled_rows( kept, 0 );
+    spilled_rows( spilled, 4096 );
+    read_back( kept, want, size );
+    read_back( spilled, got, size );
+    check( "spilling_changes_nothing", strlen( want ) > 100000 && 0 == strcmp( want, got ),
+           "spilled output differs" );
+    free( want );
+    free( got );
+    fclose( kept );
+    fclose( spilled );
+}
+
+static atomic_int producing;
+
+static void *
+produce( void *table ){
+    static const char text[] = "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx";
+    unsigned seed = (unsigned)(size_t)&seed;
+    int r;
+    for( r = 0; r < 100000; r++ ){
+        ctprintf( table, "%s|\n", text + rand_r( &seed ) % ( sizeof( text ) - 1 ) );
+    }
+    atomic_fetch_sub( &producing, 1 );
+    return NULL;
+}
+
+static void
+shared_flush_while_publishing( void ){
+    // A row published between taking the rows and reading the widths
+    // had its width counted in the wrong flush.
+    FILE *f = tmpfile();
+    ctable_t *t = ctcreate_shared( f, CPRINTF_ORDER_INSERTION );
+    pthread_t producers[4];
+    char line[128];
+    size_t i, length, width = 0;
+    int aligned = 1;
+    atomic_store( &producing, 4 );
+    for( i = 0; i < 4; i++ ){
+        pthread_create( &producers[i], NULL, produce, t );
+    }
+    while( atomic_load( &producing ) > 0 ){
+        ctflush( t );
+        fputs( "--\n", f );
+    }
+    for( i = 0; i < 4; i++ ){
+        pthread_join( producers[i], NULL );
+    }
+    ctflush( t );
+    rewind( f );
+    while( fgets( line, sizeof( line ), f ) ){
+        length = strlen( line );
+        if( 0 == strcmp( line, "--\n" ) ){
+            width = 0;
+        }else if( 0 == width ){
+            width = length;
+        }else if( length != width ){
+            aligned = 0;
+        }
+    }
+    ctdestroy( t );
+    fclose( f );
+    check( "shared_flush_while_publishing", aligned, "rows of one flush differ in width" );
+}
+
+static void *
+produce_formats( void *table ){
+    // A format of its own for every row, in a buffer that's reused.
+    static const char *words[] = { "abc", "bc", "c" };
+    static atomic_int next;
+    int id = atomic_fetch_add( &next, 1 ), r;
+    char fmt[32];
+    for( r = 0; r < 1500; r++ ){
+        snprintf( fmt, sizeof( fmt ), "%%d|%%s|%d\n", r );
+        ctkprintf( table, id * 10000 + r, fmt, id, words[ r % 3 ] );
+    }
+    return NULL;
+}
+
+static void
+shared_rows_keep_uncached_formats( void ){
+    // Once the format cache was full, shared tables kept every format
+    // compiled after it until the table was destroyed.  The rows now
+    // carry their own copies; each must still print as it was made.
+    FILE *f = tmpfile();
+    ctable_t *t = ctcreate_shared( f, CPRINTF_ORDER_KEY );
+    pthread_t producers[4];
+    static const char *words[] = { "abc", "bc", "c" };
+    char line[128], want[64], *p, *q;
+    int i, r, same = 1;
+    for( i = 0; i < 4; i++ ){
+        pthread_create( &producers[i], NULL, produce_formats, t );
+    }
+    for( i = 0; i < 4; i++ ){
+        pthread_join( producers[i], NULL );
+    }
+    ctflush( t );
+    ctdestroy( t );
+    rewind( f );
+    for( i = 0; i < 4 && same; i++ ){
+        for( r = 0; r < 1500 && same; r++ ){
+            if( NULL == fgets( line, sizeof( line ), f ) ){
+                same = 0;
+                break;
+            }
+            for( p = q = line; '\0' != *p; p++ ){
+                if( ' ' != *p ){
+                    *q++ = *p;
+                }
+            }
+            *q = '\0';
+            snprintf( want, sizeof( want ), "%d|%s|%d\n", i, words[ r % 3 ], r );
+            same = 0 == strcmp( line, want );
+        }
+    }
+    fclose( f );
+    check( "shared_rows_keep_uncached_formats", same, "a row lost its format" );
+}
+
+struct text{
+    char *p;
+    size_t length, size;
+};
+
+static void
+append_text( void *context, const char *data, size_t length ){
+    struct text *s = context;
+    if( s->length + length + 1 > s->size ){
+        s->size = ( s->length + length + 1 ) * 2;
+        s->p = realloc( s->p, s->size );
+    }
+    memcpy( s->p + s->length, data, length );
+    s->length += length;
+    s->p[ s->length ] = '\0';
+}
+
+static void
+fill( ctable_t *t, int nrows ){
+    static const char *words[] = { "a", "bb", "ccc dd", "", "eeeeeeeeeeee" };
+    int r;
+    for( r = 0; r < nrows; r++ ){
+        ctprintf( t, "%d %s|%8.3f %-6s|%c\n", r * 7919 % 100003, words[ r % 5 ],
+                  r / 7.0, words[ r * 3 % 5 ], 'a' + r % 26 );
+    }
+    ctflush( t );
+}
+
+static char *
+filled( int nrows ){
+    // What fill() writes, from a string table.
+    ctable_t *t = ctcreate_string();
+    char *s;
+    fill( t, nrows );
+    s = ctstring( t );
+    ctdestroy( t );
+    return s;
+}
+
+struct reader{
+    int fd;
+    struct text text;
+};
+
+static void *
+read_slowly( void *context ){
+    // Keeps the pipe full, so the writer blocks long enough for the
+    // timer to interrupt it part way through a writev().
+    struct reader *r = context;
+    char buf[4096];
+    ssize_t n;
+    while( ( n = read( r->fd, buf, sizeof( buf ) ) ) != 0 ){
+        if( n > 0 ){
+            append_text( &r->text, buf, n );
+            usleep( 50 );
+        }
+    }
+    return NULL;
+}
+
+static void
+interrupt( int signal ){
+    (void)signal;
+}
+
+static void
+fd_sink_finishes_partial_writes( void ){
+    // Any bytes a writev() leaves unwritten go out with the next one.
+    struct sigaction action, old;
+    struct itimerval timer = { { 0, 200 }, { 0, 200 } }, stop = { { 0, 0 }, { 0, 0 } };
+    struct reader r = { -1, { NULL, 0, 0 } };
+    sigset_t alarm, saved;
+    pthread_t reader;
+    ctable_t *t;
+    int fds[2], error;
+    char *want = filled( 100000 );
+
+    if( 0 != pipe( fds ) ){
+        check( "fd_sink_finishes_partial_writes", 0, strerror( errno ) );
+        free( want );
+        return;
+    }
+    r.fd = fds[0];
+
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = interrupt;      // no SA_RESTART
+    sigaction( SIGALRM, &action, &old );
+    sigemptyset( &alarm );
+    sigaddset( &alarm, SIGALRM );
+    pthread_sigmask( SIG_BLOCK, &alarm, &saved );
+    pthread_create( &reader, NULL, read_slowly, &r );
+    pthread_sigmask( SIG_SETMASK, &saved, NULL );
+
+    t = ctcreate_fd( fds[1] );
+    setitimer( ITIMER_REAL, &timer, NULL );
+    fill( t, 100000 );
+    setitimer( ITIMER_REAL, &stop, NULL );
+    sigaction( SIGALRM, &old, NULL );
+    error = cterror( t );
+    ctdestroy( t );
+    close( fds[1] );
+    pthread_join( reader, NULL );
+    close( fds[0] );
+    check( "fd_sink_finishes_partial_writes", 0 == error && NULL != r.text.p && 0 == strcmp( r.text.p, want ),
+           0 != error ? strerror( error ) : "output differs from a string table's" );
+    free( r.text.p );
+    free( want );
+}
+
+static void
+write_errors_are_reported( void ){
+    // A failed write used to abort, or pass unnoticed.
+    void (*saved)( int );
+    FILE *full = fopen( "/dev/full", "w" );
+    ctable_t *t;
+    int fds[2], error;
+
+    if( 0 != pipe( fds ) || NULL == full ){
+        check( "fd_write_errors_are_reported", 0, strerror( errno ) );
+        return;
+    }
+    close( fds[0] );
+    saved = signal( SIGPIPE, SIG_IGN );
+    t = ctcreate_fd( fds[1] );
+    fill( t, 10 );
+    error = cterror( t );
+    check( "fd_write_errors_are_reported", EPIPE == error && 0 == cterror( t ), strerror( error ) );
+    ctdestroy( t );
+    close( fds[1] );
+    signal( SIGPIPE, saved );
+
+    setvbuf( full, NULL, _IONBF, 0 );
+    t = ctcreate( full );
+    fill( t, 10 );
+    fill( t, 10 );
+    error = cterror( t );
+    check( "stream_write_errors_are_reported", ENOSPC == error && 0 == cterror( t ), strerror( error ) );
+    ctdestroy( t );
+    fclose( full );
+}
+
+static void
+buffer_sink_truncates_like_snprintf( void ){
+    // As much as fits, always terminated, and the length of it all.
+    char *want = filled( 20 ), buffer[32];
+    ctable_t *t;
+    memset( buffer, '#', sizeof( buffer ) );
+    t = ctcreate_buffer( buffer, 16 );
+    fill( t, 20 );
+    check( "buffer_sink_truncates_like_snprintf",
+           0 == strncmp( buffer, want, 15 ) && '\0' == buffer[15] && '#' == buffer[16]
+           && ctlength( t ) == strlen( want ), buffer );
+    ctdestroy( t );
+    free( want );
+}
+
+static void
+csnprintf_writes_at_cflush( void ){
+    char str[16];
+    memset( str, '#', sizeof( str ) );
+    csnprintf( str, 12, "%s|%d\n", "a", 100 );
+    csnprintf( str, 12, "%s|%d\n", "bcd", 2 );
+    cflush();
+    check( "csnprintf_writes_at_cflush", 0 == strcmp( str, "  a|100\nbcd" ) && '#' == str[12], str );
+}
+
+static void
+callback_sink_gets_every_chunk( void ){
+    // Well over the sixteen 64 KiB buffers assembled between writes.
+    struct text got = { NULL, 0, 0 };
+    char *want = filled( 100000 );
+    ctable_t *t = ctcreate_callback( append_text, &got );
+    fill( t, 100000 );
+    ctdestroy( t );
+    check( "callback_sink_gets_every_chunk", strlen( want ) > 2 << 20 && NULL != got.p
+           && 0 == strcmp( got.p, want ), "output differs from a string table's" );
+    free( got.p );
+    free( want );
+}
+
+static void
+discard( void *context, const char *data, size_t length ){
+    (void)context;
+    (void)data;
+    (void)length;
+}
+
+static void
+streaming_drops_uncached_formats( void ){
+    // Once the format cache was full, every streamed row's format was
+    // kept until the next flush.  The header kept for reprinting must
+    // outlive the format it came from.
+    ctable_t *t = ctcreate_callback( discard, NULL );
+    cprintf_stats_t early, late;
+    char fmt[64];
+    int r;
+    ctstream( t, 1, NULL, 0, CPRINTF_REHEADER );
+    for( r = 0; r < 200000; r++ ){
+        snprintf( fmt, sizeof( fmt ), "%d:%%s %%d\n", r );
+        ctprintf( t, fmt, "x", r % 1000 == 999 ? r : 1 );
+        if( 10000 == r ){
+            ctstats( t, &early );
+        }
+    }
+    ctstats( t, &late );
+    ctflush( t );
+    ctdestroy( t );
+    check( "streaming_drops_uncached_formats", late.bytes_held <= early.bytes_held + 65536,
+           "memory grew with the rows streamed" );
+}
+
+static void
+shared_tables_drop_uncached_formats( void ){
+    // Shared tables never freed the formats compiled once their cache
+    // was full.
+    FILE *f = fopen( "/dev/null", "w" );
+    ctable_t *t = ctcreate_shared( f, CPRINTF_ORDER_INSERTION );
+    cprintf_stats_t early, late;
+    char fmt[64];
+    int flush, r;
+    for( flush = 0; flush < 10; flush++ ){
+        for( r = 0; r < 5000; r++ ){
+            snprintf( fmt, sizeof( fmt ), "%d:%%s %%d\n", r + 5000 * flush );
+            ctprintf( t, fmt, "x", r );
+        }
+        ctflush( t );
+        ctstats( t, 0 == flush ? &early : &late );
+    }
+    ctdestroy( t );
+    fclose( f );
+    check( "shared_tables_drop_uncached_formats", late.bytes_held <= early.bytes_held + 65536,
+           "memory grew with the rows flushed" );
+}
+
+static void
+async_flushes_report_write_errors( void ){
+    // The writer thread's failures are the table's.
+    FILE *full = fopen( "/dev/full", "w" );
+    ctable_t *t;
+    int error;
+    if( NULL == full ){
+        check( "async_flushes_report_write_errors", 0, strerror( errno ) );
+        return;
+    }
+    setvbuf( full, NULL, _IONBF, 0 );
+    t = ctcreate( full );
+    ctprintf( t, "%s|%d\n", "a", 1 );
+    ctflush_async( t );
+    ctprintf( t, "%s|%d\n", "b", 2 );
+    ctflush_async( t );
+    error = cterror( t );
+    check( "async_flushes_report_write_errors", ENOSPC == error && 0 == cterror( t ), strerror( error ) );
+    ctdestroy( t );
+    fclose( full );
+}
+
+static void
+multibyte_columns_align( void ){
+    // Columns were measured in bytes, so "µs" took three and "漢字"
+    // six, rather than two and four.  A combining accent takes none.
+    ctable_t *t = ctcreate_string();
+    char *s;
+    ctprintf( t, "%s|%s\n", "µs", "x" );
+    ctprintf( t, "%s|%s\n", "漢字", "y" );
+    ctprintf( t, "%s|%s\n", "e\xcc\x81", "z" );
+    ctprintf( t, "%s|%s\n", "abc", "w" );
+    ctprintf( t, "%-5s|%s\n", "漢", "v" );     // the width is in bytes, as printf()'s
+    ctflush( t );
+    s = ctstring( t );
+    check( "multibyte_columns_align",
+           0 == strcmp( s, "  µs|x\n漢字|y\n   e\xcc\x81|z\n abc|w\n漢  |v\n" ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+static void
+truncation_keeps_whole_characters( void ){
+    // CPRINTF_TRUNCATE cut at a byte count, splitting characters.
+    ctable_t *t = ctcreate_string();
+    char *s;
+    ctstream( t, 1, NULL, 0, CPRINTF_TRUNCATE );
+    ctprintf( t, "%s|%s\n", "ab", "c" );
+    ctprintf( t, "%s|%s\n", "漢字x", "d" );
+    ctprintf( t, "%s|%s\n", "µµµ", "e" );
+    ctprintf( t, "%s|%s\n", "e\xcc\x81" "e\xcc\x81" "e", "f" );
+    ctprintf( t, "%s|%s\n", "a漢", "g" );
+    ctflush( t );
+    s = ctstring( t );
+    check( "truncation_keeps_whole_characters",
+           0 == strcmp( s, "ab|c\n漢|d\nµµ|e\ne\xcc\x81" "e\xcc\x81|f\n a|g\n" ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+static void
+ascii_prefix_edges( void ){
+    // ASCII is skipped sixteen bytes at a time; the first wide
+    // character may sit either side of each boundary.
+    static const size_t lengths[] = { 0, 1, 15, 16, 17, 31, 32, 33 };
+    const size_t n = sizeof( lengths ) / sizeof( lengths[0] );
+    ctable_t *t = ctcreate_string();
+    char value[64], want[1024], *s, *p = want;
+    size_t i, kept, widest = lengths[ n - 1 ] + 2;
+    for( i = 0; i < n; i++ ){
+        memset( value, 'a', lengths[i] );
+        strcpy( value + lengths[i], "漢" );
+        ctprintf( t, "%s|\n", value );
+        p += sprintf( p, "%*s%s|\n", (int)( widest - lengths[i] - 2 ), "", value );
+    }
+    ctflush( t );
+    s = ctstring( t );
+    check( "ascii_prefix_edges", 0 == strcmp( s, want ), s );
+    free( s );
+
+    // And cut to sixteen columns from either side.
+    ctstream( t, 1, NULL, 0, CPRINTF_TRUNCATE );
+    ctprintf( t, "%s|\n", "aaaaaaaaaaaaaaaa" );
+    p = want;
+    p += sprintf( p, "aaaaaaaaaaaaaaaa|\n" );
+    for( i = 0; i < n; i++ ){
+        memset( value, 'a', lengths[i] );
+        strcpy( value + lengths[i], "漢" );
+        ctprintf( t, "%s|\n", value );
+        if( lengths[i] + 2 <= 16 ){
+            p += sprintf( p, "%*s%s|\n", (int)( 14 - lengths[i] ), "", value );
+        }else{
+            kept = lengths[i] < 16 ? lengths[i] : 16;
+            p += sprintf( p, "%*s%.*s|\n", (int)( 16 - kept ), "", (int)kept, value );
+        }
+    }
+    ctflush( t );
+    s = ctstring( t );
+    check( "ascii_prefix_edges_truncated", 0 == strcmp( s, want ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+static void
+more_threads_after_a_parallel_flush( void ){
+    // The per-worker cursors were sized for the first thread count.
+    struct text got = { NULL, 0, 0 };
+    ctable_t *t = ctcreate_callback( append_text, &got ), *one = ctcreate_string();
+    char *want;
+    long r;
+    ctthreads( t, 2 );
+    for( r = 0; r < 200000; r++ ){
+        ctprintf( t, "%ld %s %d\n", r, "x", (int)( r % 7 ) );
+    }
+    ctflush( t );
+    got.length = 0;
+    ctthreads( t, 8 );
+    for( r = 0; r < 800000; r++ ){
+        ctprintf( t, "%ld %s %d\n", r, "x", (int)( r % 7 ) );
+        ctprintf( one, "%ld %s %d\n", r, "x", (int)( r % 7 ) );
+    }
+    ctflush( t );
+    ctflush( one );
+    want = ctstring( one );
+    check( "more_threads_after_a_parallel_flush", NULL != got.p && 0 == strcmp( got.p, want ),
+           "output differs from one thread's" );
+    free( want );
+    free( got.p );
+    ctdestroy( t );
+    ctdestroy( one );
+}
+
+static void
+export_keeps_spaces_in_values( void ){
+    // Field width padding was found by stripping spaces, which also
+    // took those that were part of the value.
+    ctable_t *t = ctcreate_string();
+    char *s;
+    ctprintf( t, "%5s|%-6s|%3c|%5s|%-4ls\n", " abc ", "ab  ", 'x', "ab", L"é" );
+    ctflush_as( t, CPRINTF_TSV );
+    s = ctstring( t );
+    check( "export_keeps_spaces_in_values", 0 == strcmp( s, " abc \tab  \tx\tab\té\n" ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+static char *
+exported( size_t threshold ){
+    ctable_t *t = ctcreate_string();
+    char *s;
+    int r;
+    ctspill( t, threshold, NULL );
+    for( r = 0; r < 2000; r++ ){
+        ctprintf( t, "%d %8.2f %6s\n", r, r / 4.0, r % 2 ? "odd" : "even" );
+    }
+    ctflush_as( t, CPRINTF_CSV );
+    s = ctstring( t );
+    ctdestroy( t );
+    return s;
+}
+
+static void
+spilled_rows_export_the_same( void ){
+    // Exports read spilled rows back from the file, and %g values
+    // through a format of their own.
+    char *kept = exported( 0 ), *spilled = exported( 4096 );
+    check( "spilled_rows_export_the_same", 0 == strcmp( kept, spilled ) && NULL != strstr( kept, "\n1999,499.75,odd\n" ),
+           spilled );
+    free( kept );
+    free( spilled );
+}
+
+// Just enough of a terminal to play back a live table:  text, \r, \n,
+// and the ESC [ n A, B, G, K and J sequences.
+#define SCREEN_ROWS 64
+#define SCREEN_COLUMNS 80
+
+struct screen{
+    char cells[ SCREEN_ROWS ][ SCREEN_COLUMNS + 1 ];
+    int row, column;
+};
+
+static void
+play( struct screen *s, const char *p ){
+    int n;
+    while( '\0' != *p ){
+        if( '\033' == p[0] && '[' == p[1] ){
+            p += 2;
+            for( n = 0; *p >= '0' && *p <= '9'; p++ ){
+                n = n * 10 + *p - '0';
+            }
+            n = 0 == n ? 1 : n;
+            switch( *p++ ){
+                case 'A':   s->row -= n;            break;
+                case 'B':   s->row += n;            break;
+                case 'G':   s->column = n - 1;      break;
+                case 'J':
+                    memset( s->cells[ s->row + 1 ], 0, ( SCREEN_ROWS - s->row - 1 ) * sizeof( s->cells[0] ) );
+                    // fall through
+                case 'K':
+                    memset( s->cells[ s->row ] + s->column, 0, SCREEN_COLUMNS + 1 - s->column );
+                    break;
+            }
+        }else if( '\n' == *p ){
+            s->row++;
+            s->column = 0;
+            p++;
+        }else if( '\r' == *p ){
+            s->column = 0;
+            p++;
+        }else{
+            if( s->row >= 0 && s->row < SCREEN_ROWS && s->column < SCREEN_COLUMNS ){
+                s->cells[ s->row ][ s->column ] = *p;
+            }
+            s->column++;
+            p++;
+        }
+    }
+}
+
+static int
+shows( const struct screen *s, const char *want ){
+    // Whether the screen holds want, less any trailing spaces, with
+    // the cursor on the line below it.  Cells never written count as
+    // spaces.
+    static char shown[ SCREEN_ROWS * ( SCREEN_COLUMNS + 1 ) + 1 ];
+    char *p = shown;
+    const char *q;
+    int row, c, n, nlines = 0;
+    for( row = 0; row < SCREEN_ROWS; row++ ){
+        for( n = SCREEN_COLUMNS; n > 0 && ( '\0' == s->cells[ row ][ n - 1 ] || ' ' == s->cells[ row ][ n - 1 ] ); n-- ){
+        }
+        for( c = 0; c < n; c++ ){
+            *p++ = '\0' == s->cells[ row ][c] ? ' ' : s->cells[ row ][c];
+        }
+        *p++ = '\n';
+    }
+    while( p > shown && '\n' == p[-1] ){
+        p--;
+    }
+    *p++ = '\n';
+    *p = '\0';
+    for( q = want; NULL != ( q = strchr( q, '\n' ) ); q++ ){
+        nlines++;
+    }
+    return 0 == strcmp( shown, want ) && s->row == nlines;
+}
+
+static void
+frame( ctable_t *t, const unsigned *values, int nrows ){
+    int r;
+    ctprintf( t, "%s %s %s\n", "rank", "progress", "state" );
+    for( r = 0; r < nrows; r++ ){
+        ctprintf( t, "%d %u %s\n", r, values[r], values[r] % 3 ? "run" : "wait" );
+    }
+    ctflush( t );
+}
+
+static void
+live_frames_match_full_redraws( void ){
+    // Each frame, drawn over the last by the changes alone, must look
+    // just as it would printed afresh.  Rows come and go, and values
+    // change width.
+    static struct screen screen;
+    ctable_t *live = ctcreate_string(), *full = ctcreate_string();
+    unsigned values[48] = { 0 }, seed = 1;
+    char *drawn, *want;
+    int f, r, nrows, same = 1;
+    ctlive( live, 1 );
+    for( f = 0; f < 200 && same; f++ ){
+        nrows = 40 + ( f % 7 == 6 ? -2 : 0 ) + ( f % 11 == 10 ? 3 : 0 );
+        for( r = 0; r < nrows; r++ ){
+            seed = seed * 1103515245 + 12345;
+            if( ( seed >> 16 ) % 20 == 0 ){
+                values[r] += ( seed >> 8 ) % 50 == 0 ? 100000 : 1;
+            }
+        }
+        frame( live, values, nrows );
+        frame( full, values, nrows );
+        drawn = ctstring( live );
+        want = ctstring( full );
+        play( &screen, drawn );
+        same = shows( &screen, want );
+        free( drawn );
+        free( want );
+    }
+    check( "live_frames_match_full_redraws", same, "the screen differs from a full redraw" );
+    ctdestroy( live );
+    ctdestroy( full );
+}
+
+static void
+sticky_widths_survive_async_flushes( void ){
+    // The widths left with the rows handed to the writer thread.
+    FILE *f = tmpfile();
+    ctable_t *t = ctcreate( f );
+    char text[64];
+    ctsticky( t, 1 );
+    ctprintf( t, "%s|%d\n", "abcdef", 1234 );
+    ctflush_async( t );
+    ctprintf( t, "%s|%d\n", "a", 1 );
+    ctflush_async( t );
+    ctflush_wait( t );
+    ctdestroy( t );
+    read_back( f, text, sizeof( text ) );
+    fclose( f );
+    check( "sticky_widths_survive_async_flushes", 0 == strcmp( text, "abcdef|1234\n     a|   1\n" ), text );
+}
+
+static void
+profiles_round_trip( void ){
+    // Widths saved by one table size the first row another streams,
+    // and saving them again writes the same profile.
+    char first[] = "/tmp/cprintf-profile.XXXXXX", second[] = "/tmp/cprintf-profile.XXXXXX";
+    char saved[2][256], *s;
+    FILE *f;
+    ctable_t *t = ctcreate_string();
+    close( mkstemp( first ) );
+    close( mkstemp( second ) );
+    ctsticky( t, 1 );
+    ctprintf( t, "%s|%d\n", "abcdef", 1234 );
+    ctflush( t );
+    free( ctstring( t ) );
+    ctsave_widths( t, first );
+    ctdestroy( t );
+
+    t = ctcreate_string();
+    ctload_widths( t, first );
+    ctstream( t, 0, NULL, 0, CPRINTF_WIDEN );
+    ctprintf( t, "%s|%d\n", "a", 1 );
+    ctflush( t );
+    s = ctstring( t );
+    ctsave_widths( t, second );
+    ctdestroy( t );
+
+    f = fopen( first, "r" );
+    read_back( f, saved[0], sizeof( saved[0] ) );
+    fclose( f );
+    f = fopen( second, "r" );
+    read_back( f, saved[1], sizeof( saved[1] ) );
+    fclose( f );
+    check( "profiles_round_trip", 0 == strcmp( s, "     a|   1\n" ) && 0 == strcmp( saved[0], saved[1] ), s );
+    free( s );
+    unlink( first );
+    unlink( second );
+}
+
+static void
+profiles_are_read_strictly( void ){
+    // Lists of widths were cut short at 256, and the first number of
+    // the format could be read as one more width if a space came
+    // before the tab.
+    char path[] = "/tmp/cprintf-profile.XXXXXX";
+    char *text = malloc( 1 << 16 ), *p = text;
+    FILE *f = fdopen( mkstemp( path ), "w" );
+    ctable_t *t;
+    int i;
+    fputs( "# a profile\n3 5 \t12 %d|%d\\n\n", f );
+    for( i = 0; i < 300; i++ ){
+        fprintf( f, 0 == i ? "%d" : " %d", i );
+    }
+    fputs( "\tmany\n7 4\t%s|%d\\n\n", f );
+    fclose( f );
+    t = ctcreate_string();
+    ctload_widths( t, path );
+    ctsave_widths( t, path );
+    ctdestroy( t );
+    f = fopen( path, "r" );
+    read_back( f, text, 1 << 16 );
+    fclose( f );
+    unlink( path );
+    p = strstr( text, "\tmany\n" );
+    check( "profiles_are_read_strictly", NULL == strstr( text, "12 %d" ) && NULL != strstr( text, "7 4\t%s|%d\\n\n" )
+           && NULL != p && 0 == strncmp( p - 7, "298 299\tmany", 12 ), text );
+    free( text );
+}
+
+static void
+sort_keeps_spaces_in_values( void ){
+    // Sort keys came from the same text as exports.
+    ctable_t *t = ctcreate_string();
+    cprintf_sort_key_t key = { 0, 0 };
+    char *s;
+    ctsort( t, &key, 1, 0 );
+    ctprintf( t, "%3s|\n", "b  " );
+    ctprintf( t, "%3s|\n", " c " );
+    ctflush( t );
+    s = ctstring( t );
+    check( "sort_keeps_spaces_in_values", 0 == strcmp( s, " c |\nb  |\n" ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+static void
+streamed_footers_outlive_uncached_formats( void ){
+    // The footers' shape comes from a format that, once the cache is
+    // full, goes after every streamed row.
+    ctable_t *t = ctcreate_callback( discard, NULL );
+    cprintf_stats_t early, late;
+    char fmt[64];
+    int r;
+    ctstream( t, 1, NULL, 0, CPRINTF_REHEADER );
+    ctfooter( t, CPRINTF_SUM | CPRINTF_MAX );
+    for( r = 0; r < 200000; r++ ){
+        snprintf( fmt, sizeof( fmt ), "%d:%%s %%d\n", r );
+        ctprintf( t, fmt, "x", r % 1000 == 999 ? r : 1 );
+        if( 10000 == r ){
+            ctstats( t, &early );
+        }
+    }
+    ctstats( t, &late );
+    ctflush( t );
+    ctdestroy( t );
+    check( "streamed_footers_outlive_uncached_formats", late.bytes_held <= early.bytes_held + 65536,
+           "memory grew with the rows streamed" );
+}
+
+static void
+footer_label_goes_in_a_string( void ){
+    // The label went into the first %c or %p as readily as a %s.
+    ctable_t *t = ctcreate_string();
+    char *s;
+    ctfooter( t, CPRINTF_SUM );
+    ctprintf( t, "%c|%s|%d\n", 'a', "x", 1 );
+    ctprintf( t, "%c|%s|%d\n", 'b', "y", 2 );
+    ctflush( t );
+    s = ctstring( t );
+    check( "footer_label_goes_in_a_string", 0 == strcmp( s, "a|  x|1\nb|  y|2\n |sum|3\n" ), s );
+    free( s );
+    ctdestroy( t );
+}
+
+int
+main( void ){
+    streamed_rows_widen();
+    streamed_rows_truncate();
+    streamed_rows_reheader();
+    spilling_changes_nothing();
+    shared_flush_while_publishing();
+    shared_rows_keep_uncached_formats();
+    fd_sink_finishes_partial_writes();
+    write_errors_are_reported();
+    buffer_sink_truncates_like_snprintf();
+    csnprintf_writes_at_cflush();
+    callback_sink_gets_every_chunk();
+    streaming_drops_uncached_formats();
+    shared_tables_drop_uncached_formats();
+    async_flushes_report_write_errors();
+    multibyte_columns_align();
+    truncation_keeps_whole_characters();
+    ascii_prefix_edges();
+    more_threads_after_a_parallel_flush();
+    export_keeps_spaces_in_values();
+    spilled_rows_export_the_same();
+    live_frames_match_full_redraws();
+    sticky_widths_survive_async_flushes();
+    profiles_round_trip();
+    profiles_are_read_strictly();
+    sort_keeps_spaces_in_values();
+    streamed_footers_outlive_uncached_formats();
+    footer_label_goes_in_a_string();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}